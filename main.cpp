@@ -6,6 +6,9 @@
  * - Inheritance (Vehicle -> Car, Truck, Motorbike)
  * - Polymorphism (calculateFee, displayInfo)
  * - File I/O (Persistence of data)
+ * - Write-ahead journal (Crash recovery between snapshots)
+ * - Memory-mapped binary snapshot (Fast startup)
+ * - Columnar session history archive (Completed stays)
  * - STL Vector (Dynamic memory management)
  * * Author: Ali Bal
  * Date: December 2025
@@ -16,10 +19,120 @@
 #include <string>
 #include <fstream>  // Required for File I/O (Save/Load)
 #include <ctime>    // Required for time tracking
+#include <cstdio>   // snprintf for the cached time formatter
 #include <iomanip>  // Required for output formatting
+#include <unordered_map> // Required for the plate index
+#include <cstdint>  // Fixed-width integers for binary records
+#include <cstring>  // memcpy / memset for binary records
+#include <cstddef>  // offsetof
+#include <fcntl.h>  // open() for the journal file
+#include <unistd.h> // write() / ftruncate() for the journal file
+#include <sys/mman.h> // mmap() for the binary snapshot
+#include <sys/stat.h> // fstat()
+#include <sys/resource.h> // setpriority() for the checkpoint thread
+#include <sys/syscall.h>  // gettid / ioprio_set / io_uring have no glibc wrapper here
+#include <sys/uio.h>      // iovec for io_uring buffer registration
+// The io_uring backend is optional: without the kernel headers (Linux 5.6+),
+// or with -DPARKING_NO_IO_URING, only the blocking calls are built.
+#if !defined(PARKING_NO_IO_URING) && __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#define PARKING_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#endif
+#include <sys/socket.h>   // Gate server: Unix domain sockets
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>  // Wakes the server workers on shutdown
+#include <csignal>
+#include <coroutine>  // Gate sessions (C++20)
+#include <cerrno>
+#include <thread>   // Background journal writer
+#include <mutex>
+#include <condition_variable>
+#include <chrono>   // Commit window and latency measurement
+#include <atomic>
+#include <functional>
+#include <cstdlib>  // mkstemp / mkdtemp for scratch files
+#include <climits>  // INT_MAX
+#include <algorithm>
+#include <string_view> // Zero-copy tokens for the text loader
+#include <charconv>    // from_chars: locale-free number parsing
+#include <cmath>       // llround for fees in cents
+#include <random>      // Arrivals and stays of the simulation
+#include <sstream>     // Captured lot messages of the self-check
+#include <sys/wait.h>  // waitpid() for the self-check's crashed child
 
 using namespace std;
 
+// LOCAL TIME FORMATTING
+// Produces the same text as ctime() without its newline ("Thu Oct 16 18:08:47 2026").
+// ctime() takes a libc lock and redoes the timezone work on every call; here
+// the date of the last local day seen is cached per thread and the clock part
+// is integer arithmetic on the seconds since local midnight.
+class LocalTimeFormatter {
+private:
+    time_t dayStart;  // Local midnight of the cached day
+    time_t dayEnd;    // One past its last second; equal to dayStart if nothing is cached
+    char text[64];    // "Www Mmm dd " + "hh:mm:ss" + " yyyy", rewritten in place
+    int length;
+
+    static const int CACHED_LENGTH = 24;
+
+    // Formats 't' through localtime_r() and caches its day when that is safe:
+    // not on days with a DST switch and only for four-digit years.
+    void load(time_t t) {
+        static const char* DAY_NAMES[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+        static const char* MONTH_NAMES[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                            "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+        dayStart = dayEnd = 0;
+        struct tm local;
+        if (localtime_r(&t, &local) == nullptr) {
+            length = snprintf(text, sizeof(text), "%lld", (long long)t);
+            return;
+        }
+        length = snprintf(text, sizeof(text), "%.3s %.3s%3d %.2d:%.2d:%.2d %d",
+                          DAY_NAMES[local.tm_wday], MONTH_NAMES[local.tm_mon], local.tm_mday,
+                          local.tm_hour, local.tm_min, local.tm_sec, 1900 + local.tm_year);
+
+        // If the UTC offset changes during the day, 'midnight' is off by the
+        // shift and the last second no longer lands on 23:59:59.
+        time_t midnight = t - (local.tm_hour * 3600 + local.tm_min * 60 + local.tm_sec);
+        time_t lastSecond = midnight + 86399;
+        struct tm last;
+        if (length == CACHED_LENGTH && localtime_r(&lastSecond, &last) != nullptr
+            && last.tm_mday == local.tm_mday && last.tm_hour == 23 && last.tm_min == 59 && last.tm_sec == 59) {
+            dayStart = midnight;
+            dayEnd = midnight + 86400;
+        }
+    }
+
+public:
+    LocalTimeFormatter() : dayStart(0), dayEnd(0), length(0) { text[0] = '\0'; }
+
+    // The result stays valid until the next call on this formatter.
+    string_view format(time_t t) {
+        if (t < dayStart || t >= dayEnd) {
+            load(t);
+            return string_view(text, length);
+        }
+        int seconds = (int)(t - dayStart);
+        int hour = seconds / 3600, minute = seconds / 60 % 60, second = seconds % 60;
+        char* clock = text + 11;
+        clock[0] = '0' + hour / 10;
+        clock[1] = '0' + hour % 10;
+        clock[3] = '0' + minute / 10;
+        clock[4] = '0' + minute % 10;
+        clock[6] = '0' + second / 10;
+        clock[7] = '0' + second % 10;
+        return string_view(text, CACHED_LENGTH);
+    }
+};
+
+// Thread-safe replacement for ctime(): one formatter per thread.
+inline string_view formatLocalTime(time_t t) {
+    thread_local LocalTimeFormatter formatter;
+    return formatter.format(t);
+}
+
 // ABSTRACT BASE CLASS: VEHICLE
 // It cannot be instantiated directly because of pure virtual functions.
 class Vehicle {
@@ -29,6 +142,9 @@ protected:
     time_t entryTime; // Stores the entry time as a Unix Timestamp
 
 public:
+    // Simulation Rule: Minimum charge is for 1 hour.
+    static constexpr double MINIMUM_HOURS = 1.0;
+
     // Constructor: Initializes the vehicle with plate, type, and entry time.
     // If 'entry' is 0, it defaults to the current system time.
     Vehicle(string plate, string type, time_t entry = 0) : licensePlate(plate), type(type) {
@@ -40,22 +156,23 @@ public:
     }
 
     // This makes the Vehicle class "Abstract".
-    virtual double calculateFee() = 0;
+    // 'exitTime' is when the vehicle leaves; trace replays pass their own clock.
+    virtual double calculateFee(time_t exitTime) = 0;
+
+    // Fee if the vehicle left right now.
+    double calculateFee() { return calculateFee(time(0)); }
 
     // Virtual Function: Can be overridden, but has a default implementation.
     virtual void displayInfo() {
 
-        string timeStr = ctime(&entryTime);
-        
-        // Remove the trailing newline character added by ctime
-        if (!timeStr.empty() && timeStr[timeStr.length()-1] == '\n') {
-            timeStr.erase(timeStr.length()-1);
-        }
+        // Cached local time, formatted like ctime() (without its trailing newline)
+        string_view timeStr = formatLocalTime(entryTime);
 
-        // Print formatted output used "setw" for output formatting
+        // Print formatted output used "setw" for output formatting.
+        // No flush per row: the status listing ends with endl.
         cout << left << setw(15) << type 
              << setw(15) << licensePlate 
-             << "Entry: " << timeStr << endl;
+             << "Entry: " << timeStr << '\n';
     }
 
     // Getters
@@ -70,189 +187,7052 @@ public:
 // Inherits from Vehicle. Represents standard sized vehicles.
 class Car : public Vehicle {
 public:
+    static constexpr double HOURLY_RATE = 20.0; // $20.00 per hour
+
     Car(string plate, time_t t = 0) : Vehicle(plate, "Car", t) {}
 
+    using Vehicle::calculateFee; // Keeps the fee-if-it-left-now overload visible
+
     // Override: Implements specific fee logic for Cars.
-    double calculateFee() override {
+    double calculateFee(time_t exitTime) override {
 
-        double hourlyRate = 20.0; // $20.00 per hour
+        double hours = difftime(exitTime, entryTime) / 3600.0; // Convert seconds to hours
         
-        time_t now = time(0);
-        double hours = difftime(now, entryTime) / 3600.0; // Convert seconds to hours
+        if (hours < MINIMUM_HOURS) hours = MINIMUM_HOURS;
         
-        // Simulation Rule: Minimum charge is for 1 hour.
-        if (hours < 1.0) hours = 1.0;
-        
-        return hours * hourlyRate; 
+        return hours * HOURLY_RATE; 
     }
 };
 
 class Truck : public Vehicle {
 public:
+    static constexpr double HOURLY_RATE = 50.0; // large vehicles with higher fees.
+
     Truck(string plate, time_t t = 0) : Vehicle(plate, "Truck", t) {}
 
-    double calculateFee() override {
+    using Vehicle::calculateFee;
 
-        double hourlyRate = 50.0; // large vehicles with higher fees.
+    double calculateFee(time_t exitTime) override {
 
-        time_t now = time(0);
-        double hours = difftime(now, entryTime) / 3600.0;
+        double hours = difftime(exitTime, entryTime) / 3600.0;
         
-        if (hours < 1.0) hours = 1.0;
+        if (hours < MINIMUM_HOURS) hours = MINIMUM_HOURS;
         
-        return hours * hourlyRate;
+        return hours * HOURLY_RATE;
     }
 };
 
 class Motorbike : public Vehicle {
 public:
+    static constexpr double HOURLY_RATE = 10.0; // lower fees
+
     Motorbike(string plate, time_t t = 0) : Vehicle(plate, "Motorbike", t) {}
 
-    double calculateFee() override {
-    
-        double hourlyRate = 10.0; // lower fees
+    using Vehicle::calculateFee;
 
-        time_t now = time(0);
-        double hours = difftime(now, entryTime) / 3600.0;
+    double calculateFee(time_t exitTime) override {
+
+        double hours = difftime(exitTime, entryTime) / 3600.0;
         
-        if (hours < 1.0) hours = 1.0;
+        if (hours < MINIMUM_HOURS) hours = MINIMUM_HOURS;
 
-        return hours * hourlyRate;
+        return hours * HOURLY_RATE;
     }
 };
 
-// This class manages the parking operations using a collection of Vehicle objects.
-class ParkingLot {
+// VEHICLE TYPE CODES
+// Binary files store the vehicle type as a single byte instead of its name.
+enum VehicleKind : uint8_t {
+    KIND_CAR = 0,
+    KIND_TRUCK = 1,
+    KIND_MOTORBIKE = 2,
+    KIND_UNKNOWN = 255
+};
+
+// Perfect hash for the type names: "Car", "Truck" and "Motorbike" have lengths
+// 3, 5 and 9, which are all different modulo 8. The length alone selects the
+// only possible candidate and a single memcmp confirms it.
+struct TypeNameSlot {
+    const char* name;
+    size_t length;
+    VehicleKind kind;
+};
+
+const TypeNameSlot TYPE_NAME_TABLE[8] = {
+    {nullptr, 0, KIND_UNKNOWN},
+    {"Motorbike", 9, KIND_MOTORBIKE},
+    {nullptr, 0, KIND_UNKNOWN},
+    {"Car", 3, KIND_CAR},
+    {nullptr, 0, KIND_UNKNOWN},
+    {"Truck", 5, KIND_TRUCK},
+    {nullptr, 0, KIND_UNKNOWN},
+    {nullptr, 0, KIND_UNKNOWN}
+};
+
+inline VehicleKind vehicleKindFromName(string_view type) {
+    const TypeNameSlot& slot = TYPE_NAME_TABLE[type.size() & 7];
+    if (slot.length != type.size() || memcmp(slot.name, type.data(), slot.length) != 0) {
+        return KIND_UNKNOWN;
+    }
+    return slot.kind;
+}
+
+// Reverse lookup, for reports and exports.
+inline const char* vehicleKindName(uint8_t kind) {
+    switch (kind) {
+        case KIND_CAR:       return "Car";
+        case KIND_TRUCK:     return "Truck";
+        case KIND_MOTORBIKE: return "Motorbike";
+        default:             return "Unknown";
+    }
+}
+
+// Factory: Creates the correct derived object from a type code.
+// Returns nullptr for unknown codes (e.g. a corrupted record).
+Vehicle* createVehicle(uint8_t kind, const string& plate, time_t entry) {
+    switch (kind) {
+        case KIND_CAR:       return new Car(plate, entry);
+        case KIND_TRUCK:     return new Truck(plate, entry);
+        case KIND_MOTORBIKE: return new Motorbike(plate, entry);
+        default:             return nullptr;
+    }
+}
+
+// TARIFFS
+// Pricing that a simulated lot can use instead of the rates built into the
+// vehicle classes, so sweeps can try other rates without new Vehicle types.
+// The formula is the classes' own: billed hours times the hourly rate, with
+// short stays billed for 'minimumHours'.
+struct Tariff {
+    double hourlyRate[3];   // Per VehicleKind
+    double minimumHours;
+
+    double fee(uint8_t kind, time_t entryTime, time_t exitTime) const {
+        double hours = difftime(exitTime, entryTime) / 3600.0;
+        if (hours < minimumHours) hours = minimumHours;
+        return hours * hourlyRate[kind];
+    }
+};
+
+// The prices of Car, Truck and Motorbike, taken from the classes themselves.
+const Tariff STANDARD_TARIFF = {{Car::HOURLY_RATE, Truck::HOURLY_RATE, Motorbike::HOURLY_RATE}, Vehicle::MINIMUM_HOURS};
+
+// THREAD POOL
+// Fixed set of worker threads for fork-join style work: parallelFor() hands
+// out task indices through an atomic counter and returns once every task has
+// finished. The calling thread works too, so a pool of size 1 has no workers.
+class ThreadPool {
 private:
-    // Storage: Dynamic list of pointers to Vehicle objects
-    // We use pointers (Vehicle*) to store derived objects (Car, Truck) in the same list.
-    vector<Vehicle*> parkedVehicles; 
-    
-    const int capacity = 7; // Max limit for car park
-    double totalRevenue;    // total revenue
+    vector<thread> workers;
+    mutex mtx;
+    condition_variable wake;     // New job available (or stopping)
+    condition_variable finished; // All workers left the current job
+    const function<void(size_t)>* job;
+    size_t jobSize;
+    atomic<size_t> nextTask;
+    uint64_t generation;         // Incremented per job so workers run each job once
+    unsigned busyWorkers;
+    bool stopping;
+
+    void runTasks() {
+        for (size_t i = nextTask++; i < jobSize; i = nextTask++) {
+            (*job)(i);
+        }
+    }
+
+    void workerLoop() {
+        uint64_t seen = 0;
+        unique_lock<mutex> lock(mtx);
+        while (true) {
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            lock.unlock();
+            runTasks();
+            lock.lock();
+            if (--busyWorkers == 0) finished.notify_one();
+        }
+    }
 
 public:
-    // Loads previous data from file upon startup.
-    ParkingLot() : totalRevenue(0.0) {
-        loadData(); 
+    explicit ThreadPool(unsigned threads)
+        : job(nullptr), jobSize(0), nextTask(0), generation(0), busyWorkers(0), stopping(false) {
+        for (unsigned i = 1; i < max(1u, threads); i++) {
+            workers.emplace_back(&ThreadPool::workerLoop, this);
+        }
     }
 
-    // Saves data and cleans up memory upon exit.
-    ~ParkingLot() {
-        saveData(); 
-        
-        // Memory Cleanup: Delete all dynamically allocated vehicle objects
-        for (Vehicle* v : parkedVehicles) {
-            delete v; 
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
         }
-        parkedVehicles.clear();
+        wake.notify_all();
+        for (thread& t : workers) t.join();
     }
 
-    // Method: Park a new vehicle
-    // Accepts a base class pointer, allowing any derived vehicle type.
+    unsigned size() const { return workers.size() + 1; }
 
-    void parkVehicle(Vehicle* newVehicle) {
-        if (parkedVehicles.size() >= capacity) {
-            cout << "Parking Lot is Full! " << newVehicle->getLicensePlate() << " cannot enter." << endl;
-            delete newVehicle; // Important: Delete the object since we are not storing it.
-        } else {
-            parkedVehicles.push_back(newVehicle);
-            cout << newVehicle->getType() << " (" << newVehicle->getLicensePlate() << ") parked successfully." << endl;
+    // Runs body(0) .. body(count - 1) across the pool and waits for all of them.
+    void parallelFor(size_t count, const function<void(size_t)>& body) {
+        {
+            lock_guard<mutex> lock(mtx);
+            job = &body;
+            jobSize = count;
+            nextTask = 0;
+            busyWorkers = workers.size();
+            generation++;
         }
+        wake.notify_all();
+        runTasks();
+
+        unique_lock<mutex> lock(mtx);
+        finished.wait(lock, [this] { return busyWorkers == 0; });
     }
+};
 
-    // Method: Remove a vehicle and calculate fee
-    void unparkVehicle(string plate) {
-        bool found = false;
-        
-        // Iterator is used to traverse the vector safely while erasing elements.
-        for (auto it = parkedVehicles.begin(); it != parkedVehicles.end(); ++it) {
-            if ((*it)->getLicensePlate() == plate) {
-                
-                // Polymorphism in action: correct calculateFee() is called based on object type.
-                double fee = (*it)->calculateFee();
-                totalRevenue += fee;
-
-                // Receipt Output
-                cout << "\n---------------------------------" << endl;
-                cout << "[EXIT] " << (*it)->getLicensePlate() << " is leaving." << endl;
-                cout << "Vehicle Type: " << (*it)->getType() << endl;
-                cout << "Total Fee: $" << fee << endl;
-                cout << "---------------------------------\n" << endl;
-
-                delete *it; // Free the heap memory
-                parkedVehicles.erase(it); // Remove the pointer from the vector
-                found = true;
-                break;
+// Plates are stored in fixed 16-byte fields (NUL padded) in binary files.
+const size_t MAX_PLATE_LENGTH = 15;
+
+// WRITE-AHEAD JOURNAL
+// Every park/unpark event is appended to a binary file the moment it happens,
+// so a crash loses nothing that was already handed to the OS. The snapshot
+// (parking_data.bin) remembers the last sequence number it contains; on startup
+// only journal records newer than that are replayed.
+
+enum JournalOp : uint8_t {
+    JOURNAL_PARK = 1,
+    JOURNAL_UNPARK = 2
+};
+
+// One fixed-size record per event. No implicit padding, so the checksum
+// covers well-defined bytes.
+struct JournalRecord {
+    uint64_t lsn;         // Log sequence number (strictly increasing)
+    int64_t timestamp;    // Entry time for PARK, exit time for UNPARK
+    double fee;           // Fee charged (UNPARK only)
+    int32_t spot;         // Spot index in the occupancy table
+    uint8_t op;           // JournalOp
+    uint8_t kind;         // VehicleKind
+    char plate[16];       // NUL padded license plate
+    uint8_t reserved[6];
+    uint32_t checksum;    // FNV-1a over all preceding bytes
+};
+static_assert(sizeof(JournalRecord) == 56, "JournalRecord layout must stay fixed");
+
+// FNV-1a: cheap checksum used to detect torn or garbage records. Passing the
+// result of a previous call as 'hash' checksums several ranges as one.
+uint32_t fnv1a(const void* data, size_t length, uint32_t hash = 2166136261u) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// DURABILITY LEVELS
+//  NONE    - each record is handed to the OS immediately and never fsynced.
+//  BATCHED - records are grouped and written with one write()+fdatasync() per
+//            commit window; callers do not wait (a crash can lose one window).
+//  STRICT  - same group commit, but park/unpark only confirm once their record
+//            is on disk. Concurrent callers share a single fsync.
+enum DurabilityMode {
+    DURABILITY_NONE,
+    DURABILITY_BATCHED,
+    DURABILITY_STRICT
+};
+
+// How journal commits and incremental checkpoints reach the disk: plain
+// write()/fdatasync() calls, or batched submissions through io_uring.
+enum IoBackend { IO_BLOCKING, IO_URING };
+
+struct JournalOptions {
+    DurabilityMode durability = DURABILITY_BATCHED;
+    int commitWindowMicros = 2000; // Longest time a record waits before its batch is written
+    int commitBatchRecords = 256;  // A batch is written early once this many records wait
+    IoBackend ioBackend = IO_BLOCKING;
+};
+
+// Commit latency (append -> durable) per event, bucketed by powers of two
+// microseconds so recording is O(1) and needs no allocation.
+class CommitStats {
+private:
+    uint64_t buckets[40] = {};
+    uint64_t events = 0;
+    uint64_t batches = 0;
+    double totalMicros = 0.0;
+    double maxMicros = 0.0;
+
+public:
+    void recordEvent(double micros) {
+        int bucket = 0;
+        while (bucket < 39 && (1ull << bucket) < micros) bucket++;
+        buckets[bucket]++;
+        events++;
+        totalMicros += micros;
+        if (micros > maxMicros) maxMicros = micros;
+    }
+
+    void recordBatch() { batches++; }
+
+    uint64_t eventCount() const { return events; }
+
+    // Upper bound (in microseconds) of the bucket containing the p-th percentile.
+    double percentile(double p) const {
+        uint64_t target = (uint64_t)(p / 100.0 * events);
+        uint64_t seen = 0;
+        for (int i = 0; i < 40; i++) {
+            seen += buckets[i];
+            if (seen > target) return (double)(1ull << i);
+        }
+        return maxMicros;
+    }
+
+    void print(ostream& out) const {
+        out << "Journal: " << events << " events in " << batches << " commits"
+            << ", avg " << fixed << setprecision(1) << (events ? totalMicros / events : 0.0) << " us"
+            << ", p50 <= " << percentile(50) << " us"
+            << ", p99 <= " << percentile(99) << " us"
+            << ", max " << maxMicros << " us" << defaultfloat << endl;
+    }
+};
+
+// Writes all bytes to a file descriptor, retrying on short writes.
+bool writeAll(int fd, const void* data, size_t length) {
+    const char* p = static_cast<const char*>(data);
+    while (length > 0) {
+        ssize_t n = ::write(fd, p, length);
+        if (n <= 0) return false;
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+// fsyncs the directory containing 'path', making a create/rename in it durable.
+bool syncParentDirectory(const string& path) {
+    size_t slash = path.rfind('/');
+    string dir = slash == string::npos ? "." : path.substr(0, slash + 1);
+    int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dirFd < 0) return false;
+    bool ok = fsync(dirFd) == 0;
+    ::close(dirFd);
+    return ok;
+}
+
+// IO_URING BACKEND
+// A minimal io_uring ring driven by the raw system calls (no liburing). The
+// persistence code uses it to hand the kernel several operations per
+// io_uring_enter(): a journal commit is one linked write + fdatasync, an
+// incremental checkpoint submits its page writes in bulk. A ring belongs to
+// one thread at a time. init() fails on kernels without io_uring (or where it
+// is disabled); callers then keep using the blocking calls.
+#ifdef PARKING_HAVE_IO_URING
+class IoRing {
+private:
+    int ringFd;
+    unsigned entries;
+    unsigned queued;        // Prepared, not yet submitted
+
+    void* sqRing;
+    void* cqRing;
+    size_t sqRingSize, cqRingSize, sqesSize;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    io_uring_sqe* sqes;
+    io_uring_cqe* cqes;
+
+public:
+    IoRing()
+        : ringFd(-1), entries(0), queued(0), sqRing(MAP_FAILED), cqRing(MAP_FAILED), sqRingSize(0), cqRingSize(0),
+          sqesSize(0), sqHead(nullptr), sqTail(nullptr), sqMask(nullptr), sqArray(nullptr), cqHead(nullptr),
+          cqTail(nullptr), cqMask(nullptr), sqes((io_uring_sqe*)MAP_FAILED), cqes(nullptr) {}
+
+    ~IoRing() {
+        if (sqes != MAP_FAILED) munmap(sqes, sqesSize);
+        if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingSize);
+        if (sqRing != MAP_FAILED) munmap(sqRing, sqRingSize);
+        if (ringFd >= 0) ::close(ringFd);
+    }
+
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    bool isOpen() const { return entries > 0; }
+    unsigned capacity() const { return entries; }
+
+    // Creates the ring and maps its queues. Returns false if io_uring is unavailable.
+    bool init(unsigned requestedEntries) {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int fd = (int)syscall(__NR_io_uring_setup, requestedEntries, &params);
+        if (fd < 0) return false;
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap) sqRingSize = cqRingSize = max(sqRingSize, cqRingSize);
+
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sqRing != MAP_FAILED) {
+            cqRing = singleMap ? sqRing
+                               : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        }
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        if (cqRing != MAP_FAILED) {
+            sqes = (io_uring_sqe*)mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        }
+        ringFd = fd;
+        if (sqes == MAP_FAILED) return false; // The destructor unmaps what was mapped
+
+        char* sq = (char*)sqRing;
+        sqHead = (unsigned*)(sq + params.sq_off.head);
+        sqTail = (unsigned*)(sq + params.sq_off.tail);
+        sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+        sqArray = (unsigned*)(sq + params.sq_off.array);
+        char* cq = (char*)cqRing;
+        cqHead = (unsigned*)(cq + params.cq_off.head);
+        cqTail = (unsigned*)(cq + params.cq_off.tail);
+        cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+        entries = params.sq_entries;
+        return true;
+    }
+
+    // Registers one buffer as fixed buffer 0 for IORING_OP_WRITE_FIXED, which
+    // saves the kernel mapping the pages on every write.
+    bool registerBuffer(void* data, size_t size) {
+        iovec buffer = {data, size};
+        return syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS, &buffer, 1) == 0;
+    }
+
+    // Submission queue entries that can still be prepared.
+    unsigned freeSlots() const { return entries - (*sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE)); }
+
+    // Queues a plain write; false if the submission queue is full.
+    bool prepareWrite(int fd, const void* data, unsigned length, uint64_t offset, uint64_t userData) {
+        return prepare(IORING_OP_WRITE, fd, data, length, offset, userData) != nullptr;
+    }
+
+    // Queues one operation; nullptr if the submission queue is full.
+    io_uring_sqe* prepare(uint8_t opcode, int fd, const void* data, unsigned length, uint64_t offset, uint64_t userData) {
+        unsigned tail = *sqTail;
+        if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= entries) return nullptr;
+        unsigned slot = tail & *sqMask;
+        io_uring_sqe* sqe = &sqes[slot];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)data;
+        sqe->len = length;
+        sqe->off = offset;
+        sqe->user_data = userData;
+        sqArray[slot] = slot;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        queued++;
+        return sqe;
+    }
+
+    // Submits everything queued and waits until at least 'waitCount'
+    // completions are available. One system call.
+    bool submitAndWait(unsigned waitCount) {
+        while (true) {
+            int submitted = (int)syscall(__NR_io_uring_enter, ringFd, queued, waitCount, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (submitted >= 0) {
+                queued -= submitted;
+                return true;
+            }
+            if (errno != EINTR) return false;
+        }
+    }
+
+    // Takes the next completion, if any.
+    bool reap(uint64_t& userData, int& result) {
+        unsigned head = *cqHead;
+        if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) return false;
+        const io_uring_cqe& cqe = cqes[head & *cqMask];
+        userData = cqe.user_data;
+        result = cqe.res;
+        __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    // Writes 'length' bytes at 'offset' ((uint64_t)-1: the file position, or the
+    // end for O_APPEND) and fdatasyncs, as one linked pair in one submission.
+    // 'fixed' means 'data' lies in the registered buffer.
+    bool writeAndSync(int fd, const char* data, size_t length, uint64_t offset, bool fixed) {
+        // Both entries or neither: a lone linked write would be chained to
+        // whatever is prepared next.
+        if (freeSlots() < 2) return false;
+        io_uring_sqe* writeSqe = prepare(fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, fd, data, length, offset, 0);
+        writeSqe->flags = IOSQE_IO_LINK; // The fsync only runs after a complete write
+        io_uring_sqe* syncSqe = prepare(IORING_OP_FSYNC, fd, nullptr, 0, 0, 1);
+        syncSqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        if (!submitAndWait(2)) return false;
+
+        int writeResult = -1, syncResult = -1;
+        for (int done = 0; done < 2;) {
+            uint64_t which;
+            int result;
+            if (!reap(which, result)) {
+                if (!submitAndWait(2 - done)) return false;
+                continue;
+            }
+            (which == 0 ? writeResult : syncResult) = result;
+            done++;
+        }
+        // A short write cancels the linked fsync: finish with blocking calls.
+        if (writeResult >= 0 && (size_t)writeResult < length) {
+            const char* rest = data + writeResult;
+            size_t restLength = length - writeResult;
+            bool ok = offset == (uint64_t)-1 ? writeAll(fd, rest, restLength)
+                                             : pwrite(fd, rest, restLength, offset + writeResult) == (ssize_t)restLength;
+            return ok && fdatasync(fd) == 0;
+        }
+        return writeResult == (ssize_t)length && syncResult == 0;
+    }
+};
+#else
+// Built without io_uring: the ring never opens, so every caller stays on the
+// blocking calls (and --io-backend=uring prints its usual warning).
+class IoRing {
+public:
+    bool isOpen() const { return false; }
+    unsigned capacity() const { return 0; }
+    bool init(unsigned) { return false; }
+    bool registerBuffer(void*, size_t) { return false; }
+    bool prepareWrite(int, const void*, unsigned, uint64_t, uint64_t) { return false; }
+    bool submitAndWait(unsigned) { return false; }
+    bool reap(uint64_t&, int&) { return false; }
+    bool writeAndSync(int, const char*, size_t, uint64_t, bool) { return false; }
+};
+#endif
+
+class Journal {
+private:
+    typedef chrono::steady_clock Clock;
+
+    int fd;           // File descriptor opened in append mode (-1 if closed)
+    string path;
+    uint64_t nextLsn; // Sequence number given to the next appended record
+    JournalOptions options;
+
+    // Group commit state, all guarded by 'mtx'.
+    mutex mtx;
+    condition_variable workAvailable; // Wakes the writer thread
+    condition_variable committed;     // Wakes callers waiting for durability
+    vector<JournalRecord> pending;    // Appended, not yet written
+    vector<Clock::time_point> pendingSince;
+    uint64_t durableLsn;  // Everything up to here is on disk
+    off_t segmentBytes;   // Length of the valid records in the current file
+    bool writing;         // Writer is outside the lock doing I/O
+    bool flushRequested;  // Someone needs the pending batch written now
+    bool writeFailed;     // The last commit failed; its records are pending again
+    bool stopping;
+
+    // Segment rotation requested by a checkpoint: records up to rotateAfterLsn
+    // stay in the current file, later ones go to a new one. The writer thread
+    // does the switch, so the caller never waits for I/O.
+    bool rotationRequested;
+    bool rotationSucceeded;
+    uint64_t rotateAfterLsn;
+    string rotateOldPath;
+    CommitStats stats;
+    thread writer;
+
+    // Callbacks waiting for a sequence number to become durable (whenDurable()).
+    vector<pair<uint64_t, function<void()>>> durableWaiters;
+
+    // io_uring backend, used by the writer thread only. Batches that fit are
+    // copied into the registered buffer and written with WRITE_FIXED.
+    IoRing ring;
+    vector<JournalRecord> ringBuffer;
+
+    // Reads the valid prefix of a journal file, calling apply(record) for every
+    // record with lsn > afterLsn. Returns the length of that prefix in bytes.
+    template <typename Apply>
+    off_t scan(int segmentFd, uint64_t afterLsn, Apply& apply, int& applied) {
+        off_t goodBytes = 0;
+        JournalRecord buffer[256];
+        lseek(segmentFd, 0, SEEK_SET);
+
+        while (true) {
+            ssize_t n = ::read(segmentFd, buffer, sizeof(buffer));
+            if (n <= 0) break;
+
+            size_t count = n / sizeof(JournalRecord);
+            bool corrupted = false;
+            for (size_t i = 0; i < count; i++) {
+                const JournalRecord& rec = buffer[i];
+                if (rec.checksum != fnv1a(&rec, offsetof(JournalRecord, checksum))) {
+                    corrupted = true;
+                    break;
+                }
+                goodBytes += sizeof(JournalRecord);
+                if (rec.lsn > afterLsn) {
+                    apply(rec);
+                    nextLsn = max(nextLsn, rec.lsn + 1);
+                    applied++;
+                }
             }
+            if (corrupted || n % sizeof(JournalRecord) != 0) break;
         }
+        return goodBytes;
+    }
 
-        if (!found) {
-            cout << ">> ERROR: Vehicle with plate " << plate << " not found!" << endl;
+    // Renames the current file to 'oldPath' and opens a fresh one in its
+    // place. Returns the new descriptor, or -1 (nothing renamed) on failure.
+    int switchSegment(const string& oldPath, bool syncDirectory) {
+        if (rename(path.c_str(), oldPath.c_str()) != 0) return -1;
+        int newFd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (newFd < 0) {
+            rename(oldPath.c_str(), path.c_str());
+            return -1;
         }
+        if (syncDirectory) syncParentDirectory(path);
+        return newFd;
     }
 
-    // Method: Display status of the parking lot
-    void displayStatus() {
-        cout << "\n=== PARKING LOT STATUS (" << parkedVehicles.size() << "/" << capacity << ") ===" << endl;
-        cout << "Total Revenue: $" << totalRevenue << endl;
-        cout << "--------------------------------------------------------" << endl;
-        
-        if (parkedVehicles.empty()) {
-            cout << "Parking lot is currently empty." << endl;
-        } else {
-            // Ranged-based for loop
-            for (Vehicle* v : parkedVehicles) {
-                v->displayInfo(); // Polymorphism: Calls the correct display function
+    // Writes records to 'targetFd' and makes them durable: one linked
+    // write + fdatasync submission with io_uring, two blocking calls without.
+    bool commitRecords(int targetFd, const JournalRecord* records, size_t count) {
+        size_t bytes = count * sizeof(JournalRecord);
+        if (!ring.isOpen()) return writeAll(targetFd, records, bytes) && fdatasync(targetFd) == 0;
+        bool fixed = count <= ringBuffer.size();
+        if (fixed) memcpy(ringBuffer.data(), records, bytes);
+        const char* data = fixed ? (const char*)ringBuffer.data() : (const char*)records;
+        return ring.writeAndSync(targetFd, data, bytes, (uint64_t)-1, fixed);
+    }
+
+    // Cuts anything after the valid records off the file, e.g. the part of a
+    // batch that a failed commit left behind. Later records must not follow a
+    // torn one: replay stops there and would drop them.
+    static bool trimSegment(int targetFd, off_t goodBytes) {
+        return lseek(targetFd, 0, SEEK_END) == goodBytes || ftruncate(targetFd, goodBytes) == 0;
+    }
+
+    // Commits records after the 'goodBytes' valid bytes of a segment, and
+    // counts them in on success.
+    bool commitAt(int targetFd, off_t& goodBytes, const JournalRecord* records, size_t count) {
+        if (!trimSegment(targetFd, goodBytes) || !commitRecords(targetFd, records, count)) return false;
+        goodBytes += count * sizeof(JournalRecord);
+        return true;
+    }
+
+    // Runs (and drops) the callbacks whose record is on disk now. Called by
+    // the writer thread with 'mtx' held, so callbacks must be quick.
+    void notifyDurable() {
+        size_t kept = 0;
+        for (size_t i = 0; i < durableWaiters.size(); i++) {
+            if (durableWaiters[i].first <= durableLsn) durableWaiters[i].second();
+            else durableWaiters[kept++] = move(durableWaiters[i]);
+        }
+        durableWaiters.resize(kept);
+    }
+
+    // Background thread: turns many appended records into one write + fdatasync.
+    // A failed commit confirms nothing: its records go back to the front of
+    // the queue and are written again, over the torn bytes, until it works.
+    void writerLoop() {
+        unique_lock<mutex> lock(mtx);
+        while (true) {
+            workAvailable.wait(lock, [this] { return stopping || rotationRequested || !pending.empty(); });
+            if (pending.empty() && !rotationRequested) break; // Stopping and nothing left to write
+
+            // Let the batch fill up until the window closes or it is large enough.
+            if (!pending.empty() && !rotationRequested) {
+                Clock::time_point deadline = pendingSince.front() + chrono::microseconds(options.commitWindowMicros);
+                workAvailable.wait_until(lock, deadline, [this] {
+                    return stopping || flushRequested || rotationRequested
+                        || (int)pending.size() >= options.commitBatchRecords;
+                });
+            }
+
+            vector<JournalRecord> batch;
+            vector<Clock::time_point> since;
+            batch.swap(pending);
+            since.swap(pendingSince);
+            bool rotating = rotationRequested;
+            uint64_t cut = rotateAfterLsn;
+            string oldPath = rotateOldPath;
+            writing = true;
+            lock.unlock();
+
+            // Records up to the cut finish the current segment, the rest start
+            // the next. The segment is only switched once the first part is on disk.
+            size_t split = batch.size();
+            if (rotating) {
+                split = 0;
+                while (split < batch.size() && batch[split].lsn <= cut) split++;
+            }
+            size_t durable = 0; // Leading records of the batch that are on disk
+            if (split == 0 || commitAt(fd, segmentBytes, batch.data(), split)) durable = split;
+            int newFd = -1;
+            off_t newBytes = 0;
+            if (rotating && durable == split) newFd = switchSegment(oldPath, true);
+            int tailFd = newFd >= 0 ? newFd : fd;
+            off_t& tailBytes = newFd >= 0 ? newBytes : segmentBytes;
+            if (durable == split && split < batch.size()
+                && commitAt(tailFd, tailBytes, batch.data() + split, batch.size() - split)) {
+                durable = batch.size();
+            }
+            Clock::time_point done = Clock::now();
+
+            lock.lock();
+            if (rotating && durable >= split) {
+                if (newFd >= 0) {
+                    ::close(fd);
+                    fd = newFd;
+                    segmentBytes = newBytes;
+                }
+                rotationRequested = false;
+                rotationSucceeded = newFd >= 0;
+            }
+            writing = false;
+            if (durable > 0) {
+                durableLsn = batch[durable - 1].lsn;
+                stats.recordBatch();
+                notifyDurable();
+            }
+            for (size_t i = 0; i < durable; i++) {
+                stats.recordEvent(chrono::duration<double, micro>(done - since[i]).count());
+            }
+            if (durable < batch.size()) {
+                if (!writeFailed) cerr << "Error: Could not write to journal, retrying." << endl;
+                writeFailed = true;
+                pending.insert(pending.begin(), batch.begin() + durable, batch.end());
+                pendingSince.insert(pendingSince.begin(), since.begin() + durable, since.end());
+            } else if (writeFailed) {
+                cerr << "Journal writes resumed." << endl;
+                writeFailed = false;
+            }
+            committed.notify_all();
+
+            if (writeFailed) {
+                if (stopping) {
+                    cerr << "Error: " << pending.size() << " journaled events could not be written." << endl;
+                    trimSegment(fd, segmentBytes);
+                    break;
+                }
+                workAvailable.wait_for(lock, chrono::milliseconds(100), [this] { return stopping; });
             }
         }
-        cout << "--------------------------------------------------------\n" << endl;
     }
 
-    // FILE I/O OPERATIONS
-    
-    // Saves current state to a text file
-    void saveData() {
-        ofstream outFile("parking_data.txt");
-        if (!outFile.is_open()) {
-            cout << "Error: Could not open file for saving." << endl;
-            return;
+public:
+    Journal()
+        : fd(-1), nextLsn(1), durableLsn(0), segmentBytes(0), writing(false), flushRequested(false),
+          writeFailed(false), stopping(false),
+          rotationRequested(false), rotationSucceeded(false), rotateAfterLsn(0) {}
+
+    ~Journal() {
+        if (writer.joinable()) {
+            {
+                lock_guard<mutex> lock(mtx);
+                stopping = true;
+            }
+            workAvailable.notify_one();
+            writer.join(); // Writer drains the last batch before exiting
         }
+        if (fd >= 0) ::close(fd);
+    }
 
-        // Format: TYPE LICENSE_PLATE ENTRY_TIMESTAMP
-        for (Vehicle* v : parkedVehicles) {
-            outFile << v->getType() << " " << v->getLicensePlate() << " " << v->getEntryTime() << endl;
+    bool open(const string& journalPath, const JournalOptions& opts) {
+        path = journalPath;
+        options = opts;
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) return false;
+        segmentBytes = lseek(fd, 0, SEEK_END);
+        if (options.durability != DURABILITY_NONE) {
+            // Without io_uring (or if registration fails) commits stay blocking.
+            if (options.ioBackend == IO_URING && ring.init(8)) {
+                ringBuffer.resize(max(options.commitBatchRecords, 1024));
+                if (!ring.registerBuffer(ringBuffer.data(), ringBuffer.size() * sizeof(JournalRecord))) ringBuffer.clear();
+            }
+            writer = thread(&Journal::writerLoop, this);
         }
-        outFile.close();
-        cout << "Data saved successfully." << endl;
+        return true;
     }
 
-    // Loads data from text file
-    void loadData() {
-        ifstream inFile("parking_data.txt");
-        if (!inFile.is_open()) return;
+    bool isOpen() const { return fd >= 0; }
 
-        string type, plate;
-        time_t timeEntry;
+    // Replays a rotated segment that a crash left behind (see requestRotation()).
+    // Must run before replay() so records are applied in order.
+    template <typename Apply>
+    int replaySegment(const string& segmentPath, uint64_t afterLsn, Apply apply) {
+        int segmentFd = ::open(segmentPath.c_str(), O_RDONLY);
+        if (segmentFd < 0) return 0;
+        nextLsn = max(nextLsn, afterLsn + 1);
+        int applied = 0;
+        scan(segmentFd, afterLsn, apply, applied);
+        ::close(segmentFd);
+        return applied;
+    }
+
+    // Calls apply(record) for every valid record with lsn > afterLsn, in order.
+    // A torn or corrupted tail (e.g. crash mid-write) is cut off so new records
+    // are appended right after the last good one. Must run before any append.
+    template <typename Apply>
+    int replay(uint64_t afterLsn, Apply apply) {
+        if (fd < 0) return 0;
+        nextLsn = max(nextLsn, afterLsn + 1);
 
-        // Read file line by line
-        while (inFile >> type >> plate >> timeEntry) {
-            // Factory Pattern Logic: Create correct object based on string type
-            if (type == "Car") {
-                parkedVehicles.push_back(new Car(plate, timeEntry));
-            } else if (type == "Truck") {
-                parkedVehicles.push_back(new Truck(plate, timeEntry));
-            } else if (type == "Motorbike") {
-                parkedVehicles.push_back(new Motorbike(plate, timeEntry));
+        int applied = 0;
+        off_t goodBytes = scan(fd, afterLsn, apply, applied);
+
+        if (lseek(fd, 0, SEEK_END) != goodBytes) {
+            cout << "Warning: Discarding damaged journal tail." << endl;
+            if (ftruncate(fd, goodBytes) != 0) {
+                cout << "Error: Could not repair journal." << endl;
+            }
+        }
+        segmentBytes = goodBytes; // Trimmed again before the first commit if the repair failed
+        durableLsn = nextLsn - 1;
+        return applied;
+    }
+
+    // Appends one event and returns its sequence number. Stamps the sequence
+    // number and checksum into 'rec'. O(1): NONE mode does a single write(),
+    // the other modes only queue the record for the writer thread.
+    uint64_t append(JournalRecord& rec) {
+        if (fd < 0) return 0;
+
+        lock_guard<mutex> lock(mtx);
+        rec.lsn = nextLsn++;
+        rec.checksum = fnv1a(&rec, offsetof(JournalRecord, checksum));
+
+        if (options.durability == DURABILITY_NONE) {
+            Clock::time_point start = Clock::now();
+            if ((!writeFailed || trimSegment(fd, segmentBytes)) && writeAll(fd, &rec, sizeof(rec))) {
+                segmentBytes += sizeof(rec);
+                writeFailed = false;
+            } else {
+                cerr << "Error: Could not write to journal." << endl;
+                writeFailed = true;
             }
+            durableLsn = rec.lsn;
+            stats.recordBatch();
+            stats.recordEvent(chrono::duration<double, micro>(Clock::now() - start).count());
+            return rec.lsn;
+        }
+
+        pending.push_back(rec);
+        pendingSince.push_back(Clock::now());
+        if (pending.size() == 1 || (int)pending.size() >= options.commitBatchRecords) {
+            workAvailable.notify_one();
+        }
+        return rec.lsn;
+    }
+
+    // STRICT mode: blocks until the record with this sequence number is on disk.
+    // Other modes return immediately.
+    void waitDurable(uint64_t lsn) {
+        if (options.durability != DURABILITY_STRICT || lsn == 0) return;
+        unique_lock<mutex> lock(mtx);
+        committed.wait(lock, [this, lsn] { return durableLsn >= lsn; });
+    }
+
+    // Non-blocking waitDurable(): returns false if there is nothing to wait
+    // for, otherwise calls 'callback' from the writer thread once the record
+    // is on disk. Lets an event loop keep serving while a commit is underway.
+    bool whenDurable(uint64_t lsn, function<void()> callback) {
+        if (options.durability != DURABILITY_STRICT || lsn == 0) return false;
+        lock_guard<mutex> lock(mtx);
+        if (durableLsn >= lsn) return false;
+        durableWaiters.push_back(make_pair(lsn, move(callback)));
+        return true;
+    }
+
+    // Writes out everything appended so far, without waiting for the window.
+    // Returns false if that failed (the writer keeps retrying).
+    bool flush() {
+        unique_lock<mutex> lock(mtx);
+        if (pending.empty() && !writing) return true;
+        flushRequested = true;
+        workAvailable.notify_one();
+        committed.wait(lock, [this] { return (pending.empty() || writeFailed) && !writing; });
+        flushRequested = false;
+        return pending.empty();
+    }
+
+    // Flushes pending records and forces everything written so far to disk,
+    // whatever the durability mode.
+    bool sync() {
+        if (fd < 0 || !flush()) return false;
+        lock_guard<mutex> lock(mtx);
+        return fdatasync(fd) == 0;
+    }
+
+    // Starts a new journal file for a checkpoint: every record appended so
+    // far stays in the current file, which is renamed to 'oldPath' and kept
+    // for recovery until the checkpoint is on disk; the caller then deletes
+    // it. Only flags the cut, the writer thread does the rename and the fsyncs
+    // (NONE mode switches right here, without fsync), so this is cheap enough
+    // to call under the caller's lock, which must keep appends out.
+    // Returns false without rotating if 'oldPath' still exists (an earlier
+    // checkpoint failed) or a rotation is already underway.
+    bool requestRotation(const string& oldPath) {
+        if (fd < 0 || access(oldPath.c_str(), F_OK) == 0) return false;
+
+        lock_guard<mutex> lock(mtx);
+        if (rotationRequested) return false;
+        if (options.durability == DURABILITY_NONE) {
+            int newFd = switchSegment(oldPath, false);
+            if (newFd < 0) return false;
+            ::close(fd);
+            fd = newFd;
+            segmentBytes = 0;
+            rotationSucceeded = true;
+            return true;
+        }
+        rotationRequested = true;
+        rotateAfterLsn = nextLsn - 1;
+        rotateOldPath = oldPath;
+        workAvailable.notify_one();
+        return true;
+    }
+
+    // Waits for the writer to finish a requested rotation. Returns true if the
+    // old segment is complete on disk under its new name. While commits fail
+    // the rotation is called off, so a checkpoint does not wait for the disk.
+    bool waitRotation() {
+        unique_lock<mutex> lock(mtx);
+        committed.wait(lock, [this] { return !rotationRequested || (writeFailed && !writing); });
+        if (rotationRequested) {
+            rotationRequested = false;
+            return false;
         }
-        inFile.close();
-        cout << "Previous data loaded." << endl;
+        return rotationSucceeded;
     }
+
+    // Sequence number of the most recently appended or replayed record.
+    uint64_t lastLsn() {
+        lock_guard<mutex> lock(mtx);
+        return nextLsn - 1;
+    }
+
+    void printStats(ostream& out) {
+        lock_guard<mutex> lock(mtx);
+        if (stats.eventCount() > 0) stats.print(out);
+    }
+};
+
+// BINARY SNAPSHOT FORMAT
+// Layout (all offsets are multiples of the 4 KB page size, so each section can
+// be memory-mapped and faulted in on demand):
+//   [SnapshotHeader, padded to one page]
+//   [SnapshotRecord x recordCount]  - one fixed-width record per spot
+//   [uint32_t x indexSlots]         - open-addressing plate index, spot + 1 (0 = empty)
+const uint32_t SNAPSHOT_VERSION = 1;
+const uint64_t SNAPSHOT_PAGE_SIZE = 4096;
+
+struct SnapshotHeader {
+    char magic[8];          // "PARKSNAP"
+    uint32_t version;       // SNAPSHOT_VERSION
+    uint32_t recordSize;    // sizeof(SnapshotRecord), guards against layout changes
+    uint64_t lsn;           // Last journal record contained in this snapshot
+    double revenue;         // Total revenue at that point
+    uint64_t recordCount;   // Number of spots (capacity when written)
+    uint64_t occupied;      // Number of non-empty records
+    uint64_t recordsOffset;
+    uint64_t indexOffset;
+    uint64_t indexSlots;    // Power of two
+    uint32_t reserved;
+    uint32_t checksum;      // FNV-1a over all preceding header bytes
+};
+static_assert(sizeof(SnapshotHeader) == 80, "SnapshotHeader layout must stay fixed");
+
+struct SnapshotRecord {
+    char plate[16];         // NUL padded license plate
+    int64_t entryTime;
+    uint8_t kind;           // VehicleKind, KIND_UNKNOWN marks a free spot
+    uint8_t reserved[7];
+};
+static_assert(sizeof(SnapshotRecord) == 32, "SnapshotRecord layout must stay fixed");
+
+// Copies a plate into a fixed 16-byte NUL padded field.
+void packPlate(const string& plate, char out[16]) {
+    memset(out, 0, 16);
+    memcpy(out, plate.data(), min(plate.size(), (size_t)16));
+}
+
+// Hash used by the plate index section (always over the full padded field).
+uint32_t plateHash(const char plate[16]) {
+    return fnv1a(plate, 16);
+}
+
+uint64_t roundUpToPage(uint64_t n) {
+    return (n + SNAPSHOT_PAGE_SIZE - 1) / SNAPSHOT_PAGE_SIZE * SNAPSHOT_PAGE_SIZE;
+}
+
+// Read-only memory mapping of a whole file (unmapped on destruction).
+class MappedFile {
+private:
+    void* base;
+    size_t length;
+
+public:
+    MappedFile() : base(nullptr), length(0) {}
+
+    ~MappedFile() {
+        if (base != nullptr) munmap(base, length);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Returns false if the file cannot be opened or mapped. An empty file
+    // opens successfully with size() == 0. 'populate' pre-faults every page,
+    // which is cheaper than faulting one page at a time for a full scan.
+    bool open(const string& path, bool populate = false) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            return false;
+        }
+        length = st.st_size;
+        if (length > 0) {
+            base = mmap(nullptr, length, PROT_READ, MAP_PRIVATE | (populate ? MAP_POPULATE : 0), fd, 0);
+        }
+        ::close(fd); // The mapping stays valid after closing the descriptor
+        if (base == MAP_FAILED) {
+            base = nullptr;
+            length = 0;
+            return false;
+        }
+        return true;
+    }
+
+    const char* data() const { return static_cast<const char*>(base); }
+    size_t size() const { return length; }
 };
 
-int main() {
-    ParkingLot myParkingLot;
+// Read-only view of a snapshot file through mmap. Opening only validates the
+// header; record and index pages are read from disk when first touched.
+class MappedSnapshot {
+private:
+    MappedFile file;
+    const SnapshotHeader* header;
+    const SnapshotRecord* records;
+    const uint32_t* index;
+
+public:
+    MappedSnapshot() : header(nullptr), records(nullptr), index(nullptr) {}
+
+    // Returns false if the file is missing, truncated or not a valid snapshot.
+    // Only the header is checksummed, so its layout fields are checked before
+    // anything is read through them (divisions instead of products, which
+    // could overflow).
+    bool open(const string& path) {
+        if (!file.open(path) || file.size() < sizeof(SnapshotHeader)) return false;
+
+        header = reinterpret_cast<const SnapshotHeader*>(file.data());
+        uint64_t size = file.size();
+        bool valid = memcmp(header->magic, "PARKSNAP", 8) == 0
+            && header->version == SNAPSHOT_VERSION
+            && header->recordSize == sizeof(SnapshotRecord)
+            && header->checksum == fnv1a(header, offsetof(SnapshotHeader, checksum))
+            && header->recordsOffset % SNAPSHOT_PAGE_SIZE == 0 && header->indexOffset % SNAPSHOT_PAGE_SIZE == 0
+            && header->recordsOffset >= sizeof(SnapshotHeader)
+            && header->recordsOffset <= header->indexOffset && header->indexOffset <= size
+            && header->recordCount <= (header->indexOffset - header->recordsOffset) / sizeof(SnapshotRecord)
+            && header->recordCount < UINT32_MAX && header->occupied <= header->recordCount
+            && header->indexSlots > header->recordCount && (header->indexSlots & (header->indexSlots - 1)) == 0
+            && header->indexSlots <= (size - header->indexOffset) / sizeof(uint32_t);
+        if (!valid) return false;
+
+        records = reinterpret_cast<const SnapshotRecord*>(file.data() + header->recordsOffset);
+        index = reinterpret_cast<const uint32_t*>(file.data() + header->indexOffset);
+        return true;
+    }
+
+    const SnapshotHeader& info() const { return *header; }
+
+    const SnapshotRecord& record(uint64_t spot) const { return records[spot]; }
+
+    const uint32_t* indexData() const { return index; }
+
+    // Looks a plate up in the precomputed index. Returns its spot or -1.
+    // Entries outside the records are skipped, and a full (corrupted) index
+    // ends the probe after one round instead of looping.
+    int64_t findPlate(const string& plate) const {
+        char key[16];
+        packPlate(plate, key);
+        uint64_t mask = header->indexSlots - 1;
+        uint64_t slot = plateHash(key) & mask;
+        for (uint64_t probes = 0; probes < header->indexSlots && index[slot] != 0; probes++) {
+            uint64_t spot = index[slot] - 1;
+            if (spot < header->recordCount && memcmp(records[spot].plate, key, 16) == 0) return (int64_t)spot;
+            slot = (slot + 1) & mask;
+        }
+        return -1;
+    }
+};
+
+// Point-in-time copy of the lot: taken quickly under the lock, then written
+// to disk without holding it. An incremental image only holds the record
+// pages that changed since the last checkpoint.
+struct SnapshotImage {
+    vector<SnapshotRecord> records; // One per spot, or the records of 'pages' only
+    vector<uint64_t> pages;         // Record pages in 'records' (incremental image only)
+    bool full = true;
+    uint64_t recordCount = 0;       // Spots in the lot
+    uint64_t occupied = 0;
+    uint64_t lsn = 0;
+    double revenue = 0.0;
+};
+
+const uint64_t SNAPSHOT_RECORDS_PER_PAGE = SNAPSHOT_PAGE_SIZE / sizeof(SnapshotRecord);
+
+// Index size for a lot of 'recordCount' spots. Sizing by capacity rather than
+// occupancy means the index never has to grow, so it can be updated in place.
+uint64_t snapshotIndexSlots(uint64_t recordCount) {
+    uint64_t indexSlots = 16;
+    while (indexSlots < 2 * recordCount) indexSlots *= 2;
+    return indexSlots;
+}
+
+SnapshotHeader makeSnapshotHeader(const SnapshotImage& image, uint64_t indexSlots) {
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "PARKSNAP", 8);
+    header.version = SNAPSHOT_VERSION;
+    header.recordSize = sizeof(SnapshotRecord);
+    header.lsn = image.lsn;
+    header.revenue = image.revenue;
+    header.recordCount = image.recordCount;
+    header.occupied = image.occupied;
+    header.recordsOffset = SNAPSHOT_PAGE_SIZE;
+    header.indexOffset = roundUpToPage(header.recordsOffset + image.recordCount * sizeof(SnapshotRecord));
+    header.indexSlots = indexSlots;
+    header.checksum = fnv1a(&header, offsetof(SnapshotHeader, checksum));
+    return header;
+}
+
+// Writes a full snapshot crash-safely: into "<path>.tmp", fsync, rename over
+// 'path' and fsync the directory. A crash at any point leaves either the old
+// or the new snapshot complete on disk, never a partly written one.
+bool writeSnapshotFile(const SnapshotImage& image, const vector<uint32_t>& index, const string& path) {
+    SnapshotHeader header = makeSnapshotHeader(image, index.size());
+
+    string tempPath = path + ".tmp";
+    int fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+
+    vector<char> padding(SNAPSHOT_PAGE_SIZE, 0);
+    uint64_t recordsEnd = header.recordsOffset + image.recordCount * sizeof(SnapshotRecord);
+    bool ok = writeAll(fd, &header, sizeof(header))
+        && writeAll(fd, padding.data(), header.recordsOffset - sizeof(header))
+        && writeAll(fd, image.records.data(), image.recordCount * sizeof(SnapshotRecord))
+        && writeAll(fd, padding.data(), header.indexOffset - recordsEnd)
+        && writeAll(fd, index.data(), index.size() * sizeof(uint32_t))
+        && fsync(fd) == 0;
+    ::close(fd);
+
+    if (!ok || rename(tempPath.c_str(), path.c_str()) != 0) {
+        unlink(tempPath.c_str());
+        return false;
+    }
+    syncParentDirectory(path);
+    return true;
+}
+
+// Page log used by incremental snapshots ("<snapshot>.pages"). Changed pages
+// are first written here and fsynced, then copied into the snapshot in place.
+// A crash during the in-place copy is repaired at startup by copying them
+// again; a torn page log is simply discarded, the snapshot was not touched yet.
+//   [PageLogHeader][PageLogEntry + data] x pageCount
+struct PageLogHeader {
+    char magic[8];          // "PARKPLOG"
+    uint64_t baseLsn;       // LSN of the snapshot the pages apply to
+    uint64_t lsn;           // LSN of the snapshot once they are applied
+    uint64_t pageCount;
+    uint64_t totalBytes;    // Size of the whole log
+    uint32_t reserved;
+    uint32_t checksum;      // FNV-1a over the fields above and everything after the header
+};
+static_assert(sizeof(PageLogHeader) == 48, "PageLogHeader layout must stay fixed");
+
+struct PageLogEntry {
+    uint64_t offset;        // Position in the snapshot file
+    uint64_t length;        // At most one page
+};
+
+// Copies the pages of a page log into the snapshot file, then fsyncs it.
+// With a ring, the pages are submitted in bulk (one io_uring_enter per ring
+// full) and the last one, the header page, is linked with the fdatasync once
+// all others are written.
+bool applyPageLog(const char* log, int snapshotFd, IoRing* ring = nullptr) {
+    const PageLogHeader* header = reinterpret_cast<const PageLogHeader*>(log);
+    const char* p = log + sizeof(PageLogHeader);
+    if (ring != nullptr) {
+        unsigned inFlight = 0;
+        // Waits for every write in flight; false if one was short or failed.
+        auto drain = [&]() {
+            bool ok = true;
+            while (inFlight > 0) {
+                uint64_t expected;
+                int result;
+                if (ring->reap(expected, result)) {
+                    ok = ok && result == (int)expected;
+                    inFlight--;
+                } else if (!ring->submitAndWait(inFlight)) {
+                    return false;
+                }
+            }
+            return ok;
+        };
+        for (uint64_t i = 0; i < header->pageCount; i++) {
+            PageLogEntry entry;
+            memcpy(&entry, p, sizeof(entry));
+            p += sizeof(entry);
+            if (i + 1 == header->pageCount) {
+                return drain() && ring->writeAndSync(snapshotFd, p, entry.length, entry.offset, false);
+            }
+            if (inFlight == ring->capacity() && !drain()) return false;
+            ring->prepareWrite(snapshotFd, p, entry.length, entry.offset, entry.length);
+            inFlight++;
+            p += entry.length;
+        }
+        return fdatasync(snapshotFd) == 0;
+    }
+    for (uint64_t i = 0; i < header->pageCount; i++) {
+        PageLogEntry entry;
+        memcpy(&entry, p, sizeof(entry));
+        p += sizeof(entry);
+        if (pwrite(snapshotFd, p, entry.length, entry.offset) != (ssize_t)entry.length) return false;
+        p += entry.length;
+    }
+    return fdatasync(snapshotFd) == 0;
+}
+
+// Finishes an incremental checkpoint interrupted by a crash. Called before
+// the snapshot is opened; does nothing if there is no page log.
+void recoverSnapshotPages(const string& path) {
+    string logPath = path + ".pages";
+    {
+        MappedFile log;
+        if (!log.open(logPath)) return;
+
+        const PageLogHeader* header = reinterpret_cast<const PageLogHeader*>(log.data());
+        bool valid = log.size() >= sizeof(PageLogHeader)
+            && memcmp(header->magic, "PARKPLOG", 8) == 0
+            && header->totalBytes == log.size()
+            && fnv1a(log.data() + sizeof(PageLogHeader), log.size() - sizeof(PageLogHeader),
+                     fnv1a(header, offsetof(PageLogHeader, checksum))) == header->checksum;
+
+        // The header page is the last one copied, so the snapshot still shows
+        // either the base LSN or, if the copy completed, the new one.
+        int fd = ::open(path.c_str(), O_RDWR);
+        if (valid && fd >= 0) {
+            uint64_t current = 0;
+            SnapshotHeader snapshotHeader;
+            if (pread(fd, &snapshotHeader, sizeof(snapshotHeader), 0) == sizeof(snapshotHeader)) {
+                current = snapshotHeader.lsn;
+            }
+            if (current == header->baseLsn || current == header->lsn) {
+                if (applyPageLog(log.data(), fd)) {
+                    cout << "Recovered an interrupted incremental checkpoint." << endl;
+                } else {
+                    cout << "Error: Could not repair snapshot from " << logPath << "." << endl;
+                    ::close(fd);
+                    return; // Keep the log for the next attempt
+                }
+            }
+        }
+        if (fd >= 0) ::close(fd);
+    }
+    unlink(logPath.c_str());
+    syncParentDirectory(logPath);
+}
+
+// Keeps a copy of the snapshot file's records and plate index as they are on
+// disk, so a checkpoint can rewrite just the pages that changed: the dirty
+// record pages, the index pages touched by their plates and the header page.
+// Checkpoint cost therefore follows the number of park/unpark events rather
+// than the number of parked vehicles. Calls must be serialized by the caller.
+class IncrementalSnapshot {
+private:
+    string path;
+    vector<SnapshotRecord> records; // On-disk record section
+    vector<uint32_t> index;         // On-disk index section, spot + 1 (0 = empty)
+    SnapshotHeader header;          // On-disk header
+    bool attached;                  // The copies above match the file
+    IoRing* ring;                   // Optional io_uring for writePages()
+
+    vector<bool> dirtyIndexPages;
+
+    uint64_t fullWrites, incrementalWrites, pagesWritten;
+
+    void resetIndexPages() {
+        dirtyIndexPages.assign((index.size() * sizeof(uint32_t) + SNAPSHOT_PAGE_SIZE - 1) / SNAPSHOT_PAGE_SIZE, false);
+    }
+
+    void markIndexSlot(uint64_t slot) {
+        dirtyIndexPages[slot * sizeof(uint32_t) / SNAPSHOT_PAGE_SIZE] = true;
+    }
+
+    void indexInsert(uint64_t spot) {
+        uint64_t mask = index.size() - 1;
+        uint64_t slot = plateHash(records[spot].plate) & mask;
+        while (index[slot] != 0) slot = (slot + 1) & mask;
+        index[slot] = spot + 1;
+        markIndexSlot(slot);
+    }
+
+    // Linear probing deletion without tombstones: later entries of the probe
+    // run are shifted back into the hole when their home slot allows it.
+    void indexErase(uint64_t spot) {
+        uint64_t mask = index.size() - 1;
+        uint64_t hole = plateHash(records[spot].plate) & mask;
+        while (index[hole] != spot + 1) {
+            if (index[hole] == 0) return; // Not indexed (should not happen)
+            hole = (hole + 1) & mask;
+        }
+        for (uint64_t next = (hole + 1) & mask; index[next] != 0; next = (next + 1) & mask) {
+            uint64_t home = plateHash(records[index[next] - 1].plate) & mask;
+            // Move the entry unless its home lies cyclically in (hole, next].
+            bool stays = (hole <= next) ? (hole < home && home <= next) : (hole < home || home <= next);
+            if (stays) continue;
+            index[hole] = index[next];
+            markIndexSlot(hole);
+            hole = next;
+        }
+        index[hole] = 0;
+        markIndexSlot(hole);
+    }
+
+public:
+    IncrementalSnapshot() : attached(false), ring(nullptr), fullWrites(0), incrementalWrites(0), pagesWritten(0) {
+        memset(&header, 0, sizeof(header));
+    }
+
+    // Routes the page log and page writes through io_uring (the ring must
+    // only be used by the checkpointing thread).
+    void useRing(IoRing* checkpointRing) { ring = checkpointRing; }
+
+    // Takes over the contents of a snapshot just loaded from 'snapshotPath'.
+    // Files written by older versions (index sized by occupancy) or for a
+    // different capacity are not attached; the next checkpoint is a full one.
+    void attach(const MappedSnapshot& snapshot, const string& snapshotPath, uint64_t capacity) {
+        path = snapshotPath;
+        const SnapshotHeader& info = snapshot.info();
+        attached = info.recordCount == capacity && info.indexSlots == snapshotIndexSlots(capacity);
+        if (!attached) return;
+
+        header = info;
+        records.assign(&snapshot.record(0), &snapshot.record(0) + info.recordCount);
+        index.assign(snapshot.indexData(), snapshot.indexData() + info.indexSlots);
+
+        // The index pages are not checksummed. Updating a damaged index in
+        // place could probe forever, so it is only kept if it indexes exactly
+        // the occupied records; otherwise the next checkpoint rewrites it.
+        uint64_t entries = 0, occupied = 0;
+        for (uint32_t entry : index) {
+            if (entry == 0) continue;
+            if (entry > info.recordCount || records[entry - 1].kind == KIND_UNKNOWN) {
+                attached = false;
+                return;
+            }
+            entries++;
+        }
+        for (uint64_t spot = 0; spot < info.recordCount && attached; spot++) {
+            if (records[spot].kind == KIND_UNKNOWN) continue;
+            occupied++;
+            string plate(records[spot].plate, strnlen(records[spot].plate, 16));
+            attached = snapshot.findPlate(plate) == (int64_t)spot;
+        }
+        attached = attached && entries == occupied;
+    }
+
+    // Forces the next checkpoint to be a full one.
+    void detach() { attached = false; }
+
+    // True if an incremental image for a lot of 'capacity' spots can be written.
+    bool canUpdate(uint64_t capacity) const {
+        return attached && header.recordCount == capacity;
+    }
+
+    bool writeFull(const SnapshotImage& image, const string& snapshotPath) {
+        path = snapshotPath;
+        attached = false;
+        records = image.records;
+        index.assign(snapshotIndexSlots(image.recordCount), 0);
+        resetIndexPages();
+        for (uint64_t spot = 0; spot < image.recordCount; spot++) {
+            if (records[spot].kind != KIND_UNKNOWN) indexInsert(spot);
+        }
+
+        // A page log left over from a failed incremental write must not be
+        // applied to the new file.
+        string logPath = path + ".pages";
+        unlink(logPath.c_str());
+        if (!writeSnapshotFile(image, index, path)) return false;
+
+        header = makeSnapshotHeader(image, index.size());
+        attached = true;
+        fullWrites++;
+        pagesWritten += (header.indexOffset + index.size() * sizeof(uint32_t)) / SNAPSHOT_PAGE_SIZE;
+        return true;
+    }
+
+    // Writes the changed pages of an incremental image through the page log.
+    bool writePages(const SnapshotImage& image) {
+        if (!canUpdate(image.recordCount)) return false;
+        attached = false; // Until the file matches the copies again
+
+        // Update the on-disk copies, remembering which index pages change.
+        resetIndexPages();
+        const SnapshotRecord* incoming = image.records.data();
+        for (uint64_t page : image.pages) {
+            uint64_t first = page * SNAPSHOT_RECORDS_PER_PAGE;
+            uint64_t last = min(first + SNAPSHOT_RECORDS_PER_PAGE, image.recordCount);
+            for (uint64_t spot = first; spot < last; spot++, incoming++) {
+                SnapshotRecord& current = records[spot];
+                bool wasIndexed = current.kind != KIND_UNKNOWN;
+                bool isIndexed = incoming->kind != KIND_UNKNOWN;
+                bool samePlate = memcmp(current.plate, incoming->plate, 16) == 0;
+
+                if (wasIndexed && (!isIndexed || !samePlate)) indexErase(spot);
+                current = *incoming;
+                if (isIndexed && (!wasIndexed || !samePlate)) indexInsert(spot);
+            }
+        }
+
+        SnapshotHeader newHeader = makeSnapshotHeader(image, index.size());
+
+        // Build the page log: record pages, index pages, header page last.
+        vector<char> log(sizeof(PageLogHeader));
+        uint64_t pageCount = 0;
+        auto addPage = [&](uint64_t offset, const void* data, uint64_t length) {
+            PageLogEntry entry = {offset, length};
+            const char* bytes = static_cast<const char*>(data);
+            log.insert(log.end(), reinterpret_cast<const char*>(&entry), reinterpret_cast<const char*>(&entry) + sizeof(entry));
+            log.insert(log.end(), bytes, bytes + length);
+            pageCount++;
+        };
+        for (uint64_t page : image.pages) {
+            uint64_t first = page * SNAPSHOT_RECORDS_PER_PAGE;
+            uint64_t count = min(SNAPSHOT_RECORDS_PER_PAGE, image.recordCount - first);
+            addPage(newHeader.recordsOffset + first * sizeof(SnapshotRecord), &records[first], count * sizeof(SnapshotRecord));
+        }
+        const char* indexBytes = reinterpret_cast<const char*>(index.data());
+        uint64_t indexBytesTotal = index.size() * sizeof(uint32_t);
+        for (uint64_t page = 0; page < dirtyIndexPages.size(); page++) {
+            if (!dirtyIndexPages[page]) continue;
+            uint64_t offset = page * SNAPSHOT_PAGE_SIZE;
+            addPage(newHeader.indexOffset + offset, indexBytes + offset, min(SNAPSHOT_PAGE_SIZE, indexBytesTotal - offset));
+        }
+        addPage(0, &newHeader, sizeof(newHeader));
+
+        PageLogHeader logHeader;
+        memset(&logHeader, 0, sizeof(logHeader));
+        memcpy(logHeader.magic, "PARKPLOG", 8);
+        logHeader.baseLsn = header.lsn;
+        logHeader.lsn = newHeader.lsn;
+        logHeader.pageCount = pageCount;
+        logHeader.totalBytes = log.size();
+        logHeader.checksum = fnv1a(log.data() + sizeof(PageLogHeader), log.size() - sizeof(PageLogHeader),
+                                   fnv1a(&logHeader, offsetof(PageLogHeader, checksum)));
+        memcpy(log.data(), &logHeader, sizeof(logHeader));
+
+        string logPath = path + ".pages";
+        int logFd = ::open(logPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (logFd < 0) return false;
+        bool ok = ring != nullptr ? ring->writeAndSync(logFd, log.data(), log.size(), 0, false)
+                                  : writeAll(logFd, log.data(), log.size()) && fdatasync(logFd) == 0;
+        ::close(logFd);
+        if (!ok) {
+            unlink(logPath.c_str());
+            return false;
+        }
+        syncParentDirectory(logPath);
+
+        int fd = ::open(path.c_str(), O_WRONLY);
+        if (fd < 0) return false; // The log is applied at the next startup
+        ok = applyPageLog(log.data(), fd, ring);
+        ::close(fd);
+        if (!ok) return false;
+
+        unlink(logPath.c_str());
+        syncParentDirectory(logPath);
+
+        header = newHeader;
+        attached = true;
+        incrementalWrites++;
+        pagesWritten += pageCount;
+        return true;
+    }
+
+    // Prints how many checkpoints were full or incremental.
+    void printStats(ostream& out) const {
+        if (fullWrites + incrementalWrites == 0) return;
+        out << "Checkpoints: " << fullWrites << " full, " << incrementalWrites << " incremental, "
+            << pagesWritten << " pages written" << endl;
+    }
+};
+
+// FAST TEXT LOADER
+// Parses "TYPE PLATE TIMESTAMP" files straight out of a memory mapping:
+// string_view tokens, from_chars for numbers (no locale, no stream state) and
+// the perfect hash above for the type name. Each line becomes one
+// SnapshotRecord, so no Vehicle objects are allocated while parsing.
+
+inline bool isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Splits the next blank-separated token off 'line' (empty if none is left).
+inline string_view nextToken(string_view& line) {
+    size_t start = 0;
+    while (start < line.size() && isBlank(line[start])) start++;
+    size_t stop = start;
+    while (stop < line.size() && !isBlank(line[stop])) stop++;
+    string_view token = line.substr(start, stop - start);
+    line.remove_prefix(stop);
+    return token;
+}
+
+// Parses one line into 'rec'. Returns false for comments, blank lines and
+// anything malformed (unknown type, over-long plate, bad or trailing numbers).
+inline bool parseVehicleLine(string_view line, SnapshotRecord& rec) {
+    string_view typeName = nextToken(line);
+    string_view plate = nextToken(line);
+    string_view stamp = nextToken(line);
+    if (stamp.empty() || plate.size() > MAX_PLATE_LENGTH || !nextToken(line).empty()) return false;
+
+    VehicleKind kind = vehicleKindFromName(typeName);
+    if (kind == KIND_UNKNOWN) return false;
+
+    int64_t entry;
+    from_chars_result result = from_chars(stamp.data(), stamp.data() + stamp.size(), entry);
+    if (result.ec != errc() || result.ptr != stamp.data() + stamp.size()) return false;
+
+    memset(rec.plate, 0, sizeof(rec.plate));
+    memcpy(rec.plate, plate.data(), plate.size());
+    rec.entryTime = entry;
+    rec.kind = kind;
+    memset(rec.reserved, 0, sizeof(rec.reserved));
+    return true;
+}
+
+// Returns the first byte in [p, end) that is a control character or space
+// (' ', '\t', '\r', '\n'), or 'end'. Checks 8 bytes per step: a byte below 0x21
+// sets its high bit in (x - 0x21..21) & ~x. Only the lowest such byte is used,
+// so carries into higher bytes do not matter.
+inline const char* findDelimiter(const char* p, const char* end) {
+    while (end - p >= 8) {
+        uint64_t x;
+        memcpy(&x, p, 8);
+        uint64_t hits = (x - 0x2121212121212121ull) & ~x & 0x8080808080808080ull;
+        if (hits != 0) return p + (__builtin_ctzll(hits) >> 3);
+        p += 8;
+    }
+    while (p < end && (unsigned char)*p > ' ') p++;
+    return p;
+}
+
+// Fast path for a canonical line "TYPE PLATE DIGITS\n" (single spaces, no \r).
+// Touches every byte once. Returns the start of the next line, or nullptr if
+// the line is not canonical and must go through parseVehicleLine().
+inline const char* parseCanonicalLine(const char* p, const char* end, SnapshotRecord& rec) {
+    const char* typeStart = p;
+    p = findDelimiter(p, end);
+    if (p == end || *p != ' ') return nullptr;
+    VehicleKind kind = vehicleKindFromName(string_view(typeStart, p - typeStart));
+    if (kind == KIND_UNKNOWN) return nullptr;
+
+    const char* plateStart = ++p;
+    p = findDelimiter(p, end);
+    size_t plateLength = p - plateStart;
+    if (p == end || *p != ' ' || plateLength == 0 || plateLength > MAX_PLATE_LENGTH) return nullptr;
+
+    int64_t entry;
+    from_chars_result result = from_chars(++p, end, entry);
+    if (result.ec != errc() || (result.ptr != end && *result.ptr != '\n')) return nullptr;
+
+    memset(&rec, 0, sizeof(rec));
+    memcpy(rec.plate, plateStart, plateLength);
+    rec.entryTime = entry;
+    rec.kind = kind;
+    return result.ptr == end ? end : result.ptr + 1;
+}
+
+// Parses every line in [begin, end) and appends the records to 'out'.
+// Returns the number of lines that were skipped.
+size_t parseVehicleText(const char* begin, const char* end, vector<SnapshotRecord>& out) {
+    size_t skipped = 0;
+    const char* p = begin;
+    while (p < end) {
+        out.emplace_back();
+        const char* next = parseCanonicalLine(p, end, out.back());
+        if (next != nullptr) {
+            p = next;
+            continue;
+        }
+
+        // Slow path: extra blanks, CRLF, comments or malformed lines.
+        const char* lineEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (lineEnd == nullptr) lineEnd = end;
+        if (!parseVehicleLine(string_view(p, lineEnd - p), out.back())) {
+            out.pop_back();
+            if (lineEnd > p && *p != '#') skipped++;
+        }
+        p = lineEnd + 1;
+    }
+    return skipped;
+}
+
+// Reads the optional legacy snapshot header "# LSN <n> REVENUE <x>".
+bool parseSnapshotHeader(string_view line, uint64_t& lsn, double& revenue) {
+    if (nextToken(line) != "#" || nextToken(line) != "LSN") return false;
+    string_view lsnText = nextToken(line);
+    if (nextToken(line) != "REVENUE") return false;
+    string_view revenueText = nextToken(line);
+
+    uint64_t parsedLsn;
+    double parsedRevenue;
+    if (from_chars(lsnText.data(), lsnText.data() + lsnText.size(), parsedLsn).ec != errc()) return false;
+    if (from_chars(revenueText.data(), revenueText.data() + revenueText.size(), parsedRevenue).ec != errc()) return false;
+    lsn = parsedLsn;
+    revenue = parsedRevenue;
+    return true;
+}
+
+// Text is parsed in pieces of at least this many bytes; a smaller file is not
+// worth a second thread.
+const size_t TEXT_CHUNK_BYTES = 1 << 20;
+
+// Threads worth starting for 'bytes' of text: one per piece, at most one per
+// core. A file below TEXT_CHUNK_BYTES gets 1, i.e. it is parsed inline.
+unsigned textParseThreads(size_t bytes) {
+    return (unsigned)min<size_t>(max(1u, thread::hardware_concurrency()), bytes / TEXT_CHUNK_BYTES + 1);
+}
+
+// Splits [begin, end) into about 'parts' pieces that end on line boundaries and
+// parses them in parallel. chunks[i] holds the records of piece i, so reading
+// the chunks in order gives the records in file order.
+size_t parseVehicleTextParallel(ThreadPool& pool, const char* begin, const char* end,
+                                vector<vector<SnapshotRecord>>& chunks) {
+    size_t parts = max<size_t>(1, min<size_t>(pool.size() * 4, (end - begin) / TEXT_CHUNK_BYTES + 1));
+    vector<const char*> bounds(parts + 1, end);
+    bounds[0] = begin;
+    for (size_t i = 1; i < parts; i++) {
+        const char* p = max(bounds[i - 1], begin + (end - begin) * i / parts);
+        const char* newline = static_cast<const char*>(memchr(p, '\n', end - p));
+        bounds[i] = newline ? newline + 1 : end;
+    }
+
+    chunks.assign(parts, vector<SnapshotRecord>());
+    vector<size_t> skipped(parts, 0);
+    pool.parallelFor(parts, [&](size_t i) {
+        chunks[i].reserve((bounds[i + 1] - bounds[i]) / 24);
+        skipped[i] = parseVehicleText(bounds[i], bounds[i + 1], chunks[i]);
+    });
+
+    size_t totalSkipped = 0;
+    for (size_t n : skipped) totalSkipped += n;
+    return totalSkipped;
+}
+
+// PLATE INDEX
+// License plate -> spot. Split into shards by hash so a bulk load can fill
+// different shards from different threads without any locking.
+class PlateIndex {
+public:
+    static const size_t SHARDS = 64;
+
+private:
+    vector<unordered_map<string, int>> shards;
+
+public:
+    PlateIndex() : shards(SHARDS) {}
+
+    // Top hash bits pick the shard, so they do not correlate with the bucket
+    // chosen inside the shard (which uses the low bits).
+    static size_t shardOf(string_view plate) {
+        return (hash<string_view>()(plate) >> 58) % SHARDS;
+    }
+
+    unordered_map<string, int>& shard(size_t i) { return shards[i]; }
+
+    // Returns the spot of the plate or -1.
+    int find(const string& plate) const {
+        const unordered_map<string, int>& map = shards[shardOf(plate)];
+        auto it = map.find(plate);
+        return it == map.end() ? -1 : it->second;
+    }
+
+    bool contains(const string& plate) const {
+        return shards[shardOf(plate)].count(plate) != 0;
+    }
+
+    void insert(const string& plate, int spot) {
+        shards[shardOf(plate)][plate] = spot;
+    }
+
+    void erase(const string& plate) {
+        shards[shardOf(plate)].erase(plate);
+    }
+
+    void reserve(size_t total) {
+        for (auto& map : shards) map.reserve(total / SHARDS + 1);
+    }
+};
+
+// SESSION HISTORY ARCHIVE
+// Every completed stay (plate, type, entry, exit, fee) is kept in an
+// append-only columnar file. Rows are grouped into blocks of up to 4096
+// sessions, and inside a block every column is stored separately:
+//   type  - one byte per row
+//   plate - varint id into a file-wide dictionary; a plate's text is stored
+//           only once, in the block where it first appears
+//   exit  - zigzag varint delta to the previous row's exit time
+//   dwell - zigzag varint of (exit - entry)
+//   fee   - varint, in cents
+// A typical session takes about 10 bytes, so a year of a busy garage (a few
+// million sessions) stays in the tens of MB.
+const uint32_t HISTORY_BLOCK_ROWS = 4096;
+
+enum HistorySection {
+    SECTION_DICTIONARY,
+    SECTION_TYPE,
+    SECTION_PLATE,
+    SECTION_EXIT,
+    SECTION_DWELL,
+    SECTION_FEE,
+    SECTION_COUNT
+};
+
+struct HistoryBlockHeader {
+    char magic[4];                       // "HBLK"
+    uint32_t rowCount;
+    uint32_t newPlateCount;              // Dictionary entries introduced by this block
+    uint32_t payloadBytes;               // Bytes following this header
+    uint32_t sectionBytes[SECTION_COUNT];
+    uint64_t firstNewPlateId;            // Id of the first new dictionary entry
+    uint64_t lastLsn;                    // Highest journal LSN among the rows
+    int64_t baseExitTime;                // The first exit delta is relative to this
+    uint32_t reserved;
+    uint32_t checksum;                   // FNV-1a over the header fields above and the payload
+};
+static_assert(sizeof(HistoryBlockHeader) == 72, "HistoryBlockHeader layout must stay fixed");
+
+// One completed session, as collected before it is encoded.
+struct SessionRow {
+    uint64_t lsn;        // Journal record of the unpark
+    uint32_t plateId;
+    uint8_t kind;
+    int64_t entryTime;
+    int64_t exitTime;
+    uint64_t feeCents;
+};
+
+// A block's decoded columns, for sequential scans.
+struct HistoryColumns {
+    vector<uint8_t> kinds;
+    vector<uint32_t> plateIds;
+    vector<int64_t> entryTimes;
+    vector<int64_t> exitTimes;
+    vector<uint64_t> feeCents;
+
+    size_t size() const { return kinds.size(); }
+};
+
+inline void putVarint(vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+inline bool getVarint(const uint8_t*& p, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t byte = *p++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+inline uint64_t zigzagEncode(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+inline int64_t zigzagDecode(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+// Reads an archive front to back through mmap, one block at a time. The plate
+// dictionary grows as blocks introduce new plates.
+class HistoryReader {
+private:
+    MappedFile file;
+    size_t offset;
+    vector<string> dictionary;
+
+public:
+    HistoryReader() : offset(0) {}
+
+    bool open(const string& path) {
+        offset = 0;
+        return file.open(path, true);
+    }
+
+    const vector<string>& plates() const { return dictionary; }
+
+    // Header of the next block, or nullptr at the end / at a damaged block.
+    const HistoryBlockHeader* peekHeader() const {
+        if (file.size() - offset < sizeof(HistoryBlockHeader)) return nullptr;
+        const HistoryBlockHeader* header = reinterpret_cast<const HistoryBlockHeader*>(file.data() + offset);
+        if (memcmp(header->magic, "HBLK", 4) != 0) return nullptr;
+        if (header->payloadBytes > file.size() - offset - sizeof(HistoryBlockHeader)) return nullptr;
+        return header;
+    }
+
+    // Byte offset of the next block (the length of the valid prefix at the end).
+    size_t position() const { return offset; }
+
+    // Decodes the next block into 'out'. Returns false at the end of the file
+    // or if the next block is damaged (e.g. torn by a crash).
+    bool next(HistoryColumns& out, bool verifyChecksum = true) {
+        const HistoryBlockHeader* header = peekHeader();
+        if (header == nullptr) return false;
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(header + 1);
+        const uint8_t* end = p + header->payloadBytes;
+        if (verifyChecksum) {
+            uint32_t sum = fnv1a(header, offsetof(HistoryBlockHeader, checksum));
+            if (fnv1a(p, header->payloadBytes, sum) != header->checksum) return false;
+        }
+
+        // Dictionary entries: one length byte, then the plate text.
+        const uint8_t* section = p;
+        for (uint32_t i = 0; i < header->newPlateCount; i++) {
+            if (p >= end || p + 1 + *p > end) return false;
+            dictionary.emplace_back(reinterpret_cast<const char*>(p + 1), *p);
+            p += 1 + *p;
+        }
+        if (p != section + header->sectionBytes[SECTION_DICTIONARY]) return false;
+
+        uint32_t rows = header->rowCount;
+        out.kinds.assign(p, p + rows);
+        p += header->sectionBytes[SECTION_TYPE];
+
+        out.plateIds.resize(rows);
+        out.exitTimes.resize(rows);
+        out.entryTimes.resize(rows);
+        out.feeCents.resize(rows);
+        const uint8_t* plateEnd = p + header->sectionBytes[SECTION_PLATE];
+        const uint8_t* exitP = plateEnd;
+        const uint8_t* exitEnd = exitP + header->sectionBytes[SECTION_EXIT];
+        const uint8_t* dwellP = exitEnd;
+        const uint8_t* dwellEnd = dwellP + header->sectionBytes[SECTION_DWELL];
+        const uint8_t* feeP = dwellEnd;
+        if (feeP + header->sectionBytes[SECTION_FEE] != end) return false;
+
+        int64_t exitTime = header->baseExitTime;
+        for (uint32_t i = 0; i < rows; i++) {
+            uint64_t plateId, exitDelta, dwell, fee;
+            if (!getVarint(p, plateEnd, plateId) || !getVarint(exitP, exitEnd, exitDelta)
+                || !getVarint(dwellP, dwellEnd, dwell) || !getVarint(feeP, end, fee)) {
+                return false;
+            }
+            exitTime += zigzagDecode(exitDelta);
+            out.plateIds[i] = (uint32_t)plateId;
+            out.exitTimes[i] = exitTime;
+            out.entryTimes[i] = exitTime - zigzagDecode(dwell);
+            out.feeCents[i] = fee;
+        }
+
+        offset += sizeof(HistoryBlockHeader) + header->payloadBytes;
+        return true;
+    }
+};
+
+// Rows not yet on disk, plus the plates they introduced to the dictionary.
+struct PendingHistoryBlock {
+    vector<SessionRow> rows;
+    vector<string> newPlates;
+    uint32_t firstNewPlateId = 0;
+};
+
+// Appending side of the archive. append() only buffers in memory; full blocks
+// are handed out by takeBlocks() and written by writeBlocks(), so the caller
+// decides when (and outside which locks) the I/O happens.
+class HistoryArchive {
+private:
+    int fd;
+    off_t fileBytes;                        // Length of the complete blocks in the file
+    uint64_t lastLsn;                       // Highest LSN known to the archive
+    unordered_map<string, uint32_t> plateIds;
+    uint32_t nextPlateId;
+    PendingHistoryBlock current;
+    vector<PendingHistoryBlock> sealed;
+    mutex fileMutex;                        // Serializes writeBlocks()
+
+    void sealCurrent() {
+        if (current.rows.empty()) return;
+        sealed.push_back(move(current));
+        current = PendingHistoryBlock();
+        current.firstNewPlateId = nextPlateId;
+    }
+
+    static vector<uint8_t> encode(const PendingHistoryBlock& block) {
+        vector<uint8_t> sections[SECTION_COUNT];
+        for (const string& plate : block.newPlates) {
+            sections[SECTION_DICTIONARY].push_back((uint8_t)plate.size());
+            sections[SECTION_DICTIONARY].insert(sections[SECTION_DICTIONARY].end(), plate.begin(), plate.end());
+        }
+
+        int64_t previousExit = block.rows.front().exitTime;
+        for (const SessionRow& row : block.rows) {
+            sections[SECTION_TYPE].push_back(row.kind);
+            putVarint(sections[SECTION_PLATE], row.plateId);
+            putVarint(sections[SECTION_EXIT], zigzagEncode(row.exitTime - previousExit));
+            putVarint(sections[SECTION_DWELL], zigzagEncode(row.exitTime - row.entryTime));
+            putVarint(sections[SECTION_FEE], row.feeCents);
+            previousExit = row.exitTime;
+        }
+
+        HistoryBlockHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "HBLK", 4);
+        header.rowCount = block.rows.size();
+        header.newPlateCount = block.newPlates.size();
+        header.firstNewPlateId = block.firstNewPlateId;
+        header.lastLsn = block.rows.back().lsn;
+        header.baseExitTime = block.rows.front().exitTime;
+
+        vector<uint8_t> bytes(sizeof(header));
+        for (int s = 0; s < SECTION_COUNT; s++) {
+            header.sectionBytes[s] = sections[s].size();
+            header.payloadBytes += sections[s].size();
+            bytes.insert(bytes.end(), sections[s].begin(), sections[s].end());
+        }
+        uint32_t sum = fnv1a(&header, offsetof(HistoryBlockHeader, checksum));
+        header.checksum = fnv1a(bytes.data() + sizeof(header), header.payloadBytes, sum);
+        memcpy(bytes.data(), &header, sizeof(header));
+        return bytes;
+    }
+
+public:
+    HistoryArchive() : fd(-1), fileBytes(0), lastLsn(0), nextPlateId(0) {}
+
+    ~HistoryArchive() {
+        if (fd >= 0) ::close(fd);
+    }
+
+    // Opens (or creates) the archive and rebuilds the plate dictionary. A crash
+    // can only tear the last block; anything after the last good block is cut off.
+    bool open(const string& path) {
+        {
+            HistoryReader reader;
+            if (reader.open(path)) {
+                HistoryColumns columns;
+                while (const HistoryBlockHeader* header = reader.peekHeader()) {
+                    uint64_t blockLsn = header->lastLsn;
+                    if (!reader.next(columns)) break;
+                    lastLsn = max(lastLsn, blockLsn);
+                }
+                for (const string& plate : reader.plates()) plateIds.emplace(plate, nextPlateId++);
+                fd = ::open(path.c_str(), O_WRONLY | O_APPEND);
+                if (fd >= 0 && ftruncate(fd, reader.position()) != 0) {
+                    cout << "Error: Could not repair history archive." << endl;
+                }
+            }
+        }
+        if (fd < 0) fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd >= 0) fileBytes = lseek(fd, 0, SEEK_END);
+        current.firstNewPlateId = nextPlateId;
+        return fd >= 0;
+    }
+
+    bool isOpen() const { return fd >= 0; }
+
+    // Highest journal LSN already recorded; recovery re-appends newer unparks.
+    uint64_t recordedLsn() const { return lastLsn; }
+
+    // Buffers one completed session (the caller serializes calls).
+    void append(uint64_t lsn, const string& plate, uint8_t kind, int64_t entryTime, int64_t exitTime, double fee) {
+        if (fd < 0) return;
+        auto it = plateIds.find(plate);
+        if (it == plateIds.end()) {
+            it = plateIds.emplace(plate, nextPlateId++).first;
+            current.newPlates.push_back(plate);
+        }
+
+        SessionRow row;
+        row.lsn = lsn;
+        row.plateId = it->second;
+        row.kind = kind;
+        row.entryTime = entryTime;
+        row.exitTime = exitTime;
+        row.feeCents = (uint64_t)llround(max(0.0, fee) * 100.0);
+        current.rows.push_back(row);
+        lastLsn = max(lastLsn, lsn);
+
+        if (current.rows.size() >= HISTORY_BLOCK_ROWS) sealCurrent();
+    }
+
+    // Hands out every buffered row as finished blocks (the caller serializes
+    // this with append()).
+    vector<PendingHistoryBlock> takeBlocks() {
+        sealCurrent();
+        vector<PendingHistoryBlock> blocks;
+        blocks.swap(sealed);
+        return blocks;
+    }
+
+    // Takes back blocks whose writeBlocks() failed. They go before anything
+    // sealed since, so the next write keeps the rows (and plate ids) in order.
+    void restoreBlocks(vector<PendingHistoryBlock>& blocks) {
+        sealed.insert(sealed.begin(), make_move_iterator(blocks.begin()), make_move_iterator(blocks.end()));
+        blocks.clear();
+    }
+
+    // LSN of the oldest session not yet written, or UINT64_MAX if there is none.
+    // A journal segment may only be deleted once all its sessions are written.
+    uint64_t oldestBufferedLsn() const {
+        if (!sealed.empty()) return sealed.front().rows.front().lsn;
+        if (!current.rows.empty()) return current.rows.front().lsn;
+        return UINT64_MAX;
+    }
+
+    // Encodes and appends blocks in order, then fdatasyncs. Safe to call
+    // without the caller's lock. What a failed write left behind is cut off
+    // before the next one, so restored blocks are not written after a torn
+    // block (the reader stops at the first one).
+    bool writeBlocks(const vector<PendingHistoryBlock>& blocks) {
+        if (fd < 0 || blocks.empty()) return true;
+        lock_guard<mutex> lock(fileMutex);
+        vector<uint8_t> bytes;
+        for (const PendingHistoryBlock& block : blocks) {
+            vector<uint8_t> encoded = encode(block);
+            bytes.insert(bytes.end(), encoded.begin(), encoded.end());
+        }
+        bool trimmed = lseek(fd, 0, SEEK_END) == fileBytes || ftruncate(fd, fileBytes) == 0;
+        if (!trimmed || !writeAll(fd, bytes.data(), bytes.size()) || fdatasync(fd) != 0) return false;
+        fileBytes += bytes.size();
+        return true;
+    }
+};
+
+// STREAMING EXPORT (CSV / JSON)
+// Rows are formatted straight into one reusable buffer that is written out
+// whenever it fills up, so an export needs constant memory however many rows
+// it has. Numbers and timestamps are formatted by hand: no iostream, locale
+// or snprintf work per field.
+enum ExportFormat { EXPORT_CSV, EXPORT_JSON, EXPORT_ARROW };
+
+const char DIGIT_PAIRS[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+class OutputBuffer {
+private:
+    int fd;
+    vector<char> buffer;
+    size_t used;
+    bool failed;
+
+    // Date part of the last formatted timestamp; rows are usually close in time.
+    int64_t cachedDay;
+    char cachedDate[11];
+
+public:
+    static const size_t CAPACITY = 1 << 20;
+
+    explicit OutputBuffer(int fd) : fd(fd), buffer(CAPACITY), used(0), failed(false), cachedDay(INT64_MIN) {}
+
+    // Without a file the buffer just grows; its owner drains it through
+    // data()/size()/consume(), e.g. into a non-blocking socket.
+    OutputBuffer() : fd(-1), buffer(4096), used(0), failed(false), cachedDay(INT64_MIN) {}
+
+    ~OutputBuffer() { flush(); }
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    bool ok() const { return !failed; }
+
+    bool flush() {
+        if (fd < 0) return !failed;
+        if (used > 0 && !failed) failed = !writeAll(fd, buffer.data(), used);
+        used = 0;
+        return !failed;
+    }
+
+    const char* data() const { return buffer.data(); }
+    size_t size() const { return used; }
+
+    // Drops the first 'n' buffered bytes once the owner has sent them.
+    void consume(size_t n) {
+        memmove(buffer.data(), buffer.data() + n, used - n);
+        used -= n;
+    }
+
+    // Makes room for 'n' more bytes (n <= CAPACITY with a file) and returns where they go.
+    char* reserve(size_t n) {
+        if (used + n > buffer.size()) {
+            if (fd >= 0) flush();
+            if (used + n > buffer.size()) buffer.resize(max(buffer.size() * 2, used + n));
+        }
+        return buffer.data() + used;
+    }
+
+    void append(const char* data, size_t n) {
+        if (n > CAPACITY && fd >= 0) {
+            flush();
+            if (!failed) failed = !writeAll(fd, data, n);
+            return;
+        }
+        memcpy(reserve(n), data, n);
+        used += n;
+    }
+
+    void append(string_view s) { append(s.data(), s.size()); }
+
+    void append(char c) {
+        *reserve(1) = c;
+        used++;
+    }
+
+    void appendUint(uint64_t value) {
+        char digits[20];
+        char* end = digits + sizeof(digits);
+        char* p = end;
+        while (value >= 100) {
+            p -= 2;
+            memcpy(p, DIGIT_PAIRS + (value % 100) * 2, 2);
+            value /= 100;
+        }
+        if (value >= 10) {
+            p -= 2;
+            memcpy(p, DIGIT_PAIRS + value * 2, 2);
+        } else {
+            *--p = (char)('0' + value);
+        }
+        append(p, end - p);
+    }
+
+    void appendInt(int64_t value) {
+        if (value < 0) {
+            append('-');
+            appendUint(0 - (uint64_t)value);
+        } else {
+            appendUint(value);
+        }
+    }
+
+    // Cents as a decimal amount: 2050 -> "20.50".
+    void appendCents(uint64_t cents) {
+        appendUint(cents / 100);
+        char* p = reserve(3);
+        p[0] = '.';
+        memcpy(p + 1, DIGIT_PAIRS + (cents % 100) * 2, 2);
+        used += 3;
+    }
+
+    // Fixed-point decimal with 'decimals' digits after the point (to_chars: locale-free).
+    // Values too long for that (about 1e30 and up) fall back to the shortest
+    // exact form, e.g. "1.5e+300", which always fits in 32 bytes.
+    void appendFixed(double value, int decimals) {
+        char* p = reserve(32);
+        to_chars_result written = to_chars(p, p + 32, value, chars_format::fixed, decimals);
+        if (written.ec != errc()) written = to_chars(p, p + 32, value);
+        used += written.ptr - p;
+    }
+
+    // ISO 8601 in UTC, e.g. "2026-10-16T18:08:47Z".
+    void appendTimestamp(int64_t t) {
+        int64_t day = t >= 0 ? t / 86400 : (t - 86399) / 86400;
+        int64_t secondOfDay = t - day * 86400;
+        if (day != cachedDay) {
+            // Days since 1970-01-01 to a civil date (H. Hinnant's algorithm).
+            int64_t z = day + 719468;
+            int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+            int64_t doe = z - era * 146097;
+            int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+            int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+            int64_t mp = (5 * doy + 2) / 153;
+            int64_t d = doy - (153 * mp + 2) / 5 + 1;
+            int64_t m = mp < 10 ? mp + 3 : mp - 9;
+            int64_t y = yoe + era * 400 + (m <= 2);
+            if (y < 0 || y > 9999) y = 0; // Out of range for the fixed-width format
+            memcpy(cachedDate, DIGIT_PAIRS + (y / 100) * 2, 2);
+            memcpy(cachedDate + 2, DIGIT_PAIRS + (y % 100) * 2, 2);
+            cachedDate[4] = '-';
+            memcpy(cachedDate + 5, DIGIT_PAIRS + m * 2, 2);
+            cachedDate[7] = '-';
+            memcpy(cachedDate + 8, DIGIT_PAIRS + d * 2, 2);
+            cachedDate[10] = 'T';
+            cachedDay = day;
+        }
+        char* p = reserve(20);
+        memcpy(p, cachedDate, 11);
+        memcpy(p + 11, DIGIT_PAIRS + (secondOfDay / 3600) * 2, 2);
+        p[13] = ':';
+        memcpy(p + 14, DIGIT_PAIRS + (secondOfDay / 60 % 60) * 2, 2);
+        p[16] = ':';
+        memcpy(p + 17, DIGIT_PAIRS + (secondOfDay % 60) * 2, 2);
+        p[19] = 'Z';
+        used += 20;
+    }
+
+    // A text field, quoted/escaped as the format requires.
+    void appendText(string_view s, ExportFormat format) {
+        if (format == EXPORT_JSON) {
+            append('"');
+            for (char c : s) {
+                if (c == '"' || c == '\\') {
+                    append('\\');
+                    append(c);
+                } else if ((unsigned char)c < 0x20) {
+                    append("\\u00");
+                    append("0123456789abcdef"[c >> 4]);
+                    append("0123456789abcdef"[c & 15]);
+                } else {
+                    append(c);
+                }
+            }
+            append('"');
+        } else if (s.find_first_of(",\"\r\n") == string_view::npos) {
+            append(s);
+        } else {
+            append('"');
+            for (char c : s) {
+                if (c == '"') append('"');
+                append(c);
+            }
+            append('"');
+        }
+    }
+};
+
+// Writes rows of named columns as CSV (header line + rows) or as a JSON
+// array of objects. Usage: field()/...; endRow() per row, finish() at the end.
+class RowWriter {
+private:
+    OutputBuffer& out;
+    ExportFormat format;
+    vector<const char*> columns;
+    size_t column;
+    uint64_t rows;
+
+    void beginField() {
+        if (format == EXPORT_CSV) {
+            if (column > 0) out.append(',');
+        } else {
+            out.append(column == 0 ? (rows == 0 ? "{\"" : ",\n{\"") : ",\"");
+            out.append(columns[column]);
+            out.append("\":");
+        }
+        column++;
+    }
+
+public:
+    RowWriter(OutputBuffer& out, ExportFormat format, const vector<const char*>& columns)
+        : out(out), format(format), columns(columns), column(0), rows(0) {
+        if (format == EXPORT_CSV) {
+            for (size_t i = 0; i < columns.size(); i++) {
+                if (i > 0) out.append(',');
+                out.append(columns[i]);
+            }
+            out.append('\n');
+        } else {
+            out.append("[\n");
+        }
+    }
+
+    void text(string_view s) { beginField(); out.appendText(s, format); }
+    void integer(int64_t v) { beginField(); out.appendInt(v); }
+    void cents(uint64_t v) { beginField(); out.appendCents(v); }
+    void number(double v, int decimals) { beginField(); out.appendFixed(v, decimals); }
+
+    void timestamp(int64_t t) {
+        beginField();
+        if (format == EXPORT_JSON) out.append('"');
+        out.appendTimestamp(t);
+        if (format == EXPORT_JSON) out.append('"');
+    }
+
+    void endRow() {
+        out.append(format == EXPORT_CSV ? "\n" : "}");
+        column = 0;
+        rows++;
+    }
+
+    uint64_t rowCount() const { return rows; }
+
+    bool finish() {
+        if (format == EXPORT_JSON) out.append(rows == 0 ? "]\n" : "\n]\n");
+        return out.flush();
+    }
+};
+
+// ASYNC LOGGER
+// Gate messages (park confirmations, receipts, rejections) are logged as
+// fixed-size binary records instead of being formatted and written on the
+// gate's thread. Every thread that logs owns a single-producer ring; one
+// logger thread drains all rings, formats the records into a buffer and
+// writes it to stdout in one call. Levels below PARKING_LOG_LEVEL are
+// compiled out (build with -DPARKING_LOG_LEVEL=0 to get the debug records).
+#ifndef PARKING_LOG_LEVEL
+#define PARKING_LOG_LEVEL 1 // LOG_INFO
+#endif
+
+enum LogLevel : uint8_t { LOG_DEBUG = 0, LOG_INFO = 1, LOG_WARN = 2, LOG_ERROR = 3 };
+
+enum LogEvent : uint8_t {
+    LOG_PARKED,             // kind, plate
+    LOG_LOT_FULL,           // plate
+    LOG_PLATE_TOO_LONG,     // plate
+    LOG_DUPLICATE,          // plate
+    LOG_NOT_FOUND,          // plate
+    LOG_RECEIPT,            // kind, plate, fee in cents
+    LOG_GATE_CONNECTED,     // socket
+    LOG_GATE_DISCONNECTED   // socket, command count
+};
+
+struct LogRecord {
+    uint8_t level;          // LogLevel
+    uint8_t event;          // LogEvent
+    uint8_t kind;           // VehicleKind
+    uint8_t plateLength;    // Of the original plate; only 'plate' is stored
+    int32_t socket;
+    int64_t value;          // Fee in cents or command count
+    char plate[48];
+};
+static_assert(sizeof(LogRecord) == 64, "LogRecord should fill one cache line");
+
+class LogRing {
+private:
+    static const uint64_t SIZE = 1024; // Records, a power of two
+
+    LogRecord records[SIZE];
+    alignas(64) atomic<uint64_t> head; // Next record to format (logger thread)
+    alignas(64) atomic<uint64_t> tail; // Next free slot (owning thread)
+
+public:
+    atomic<bool> owned;     // A live thread writes to this ring
+
+    LogRing() : head(0), tail(0), owned(true) {}
+
+    bool push(const LogRecord& record) {
+        uint64_t t = tail.load(memory_order_relaxed);
+        if (t - head.load(memory_order_acquire) >= SIZE) return false;
+        records[t & (SIZE - 1)] = record;
+        tail.store(t + 1, memory_order_seq_cst); // Ordered before the 'sleeping' check
+        return true;
+    }
+
+    bool empty() const { return head.load(memory_order_relaxed) == tail.load(memory_order_seq_cst); }
+
+    // Logger thread: formats everything published so far.
+    template <typename Format>
+    size_t drain(Format& format) {
+        uint64_t h = head.load(memory_order_relaxed);
+        uint64_t t = tail.load(memory_order_acquire);
+        for (uint64_t i = h; i < t; i++) format(records[i & (SIZE - 1)]);
+        head.store(t, memory_order_release);
+        return t - h;
+    }
+};
+
+class Logger {
+private:
+    mutex mtx;
+    condition_variable wake;        // Wakes the logger thread
+    condition_variable flushed;     // Wakes flush() callers
+    vector<LogRing*> rings;    // Never shrinks; freed with the logger
+    bool stopping;
+    bool wakeRequested;
+    uint64_t flushRequests;
+    uint64_t flushedRequests;
+    atomic<bool> sleeping;
+    thread worker;
+
+    // Releases the calling thread's ring when the thread ends, so the next
+    // thread can take it over.
+    struct RingOwner {
+        LogRing* ring = nullptr;
+        ~RingOwner() {
+            if (ring != nullptr) ring->owned.store(false, memory_order_release);
+        }
+    };
+
+    LogRing* threadRing() {
+        thread_local RingOwner owner;
+        if (owner.ring != nullptr) return owner.ring;
+
+        lock_guard<mutex> lock(mtx);
+        for (LogRing* ring : rings) {
+            if (!ring->owned.load(memory_order_acquire)) {
+                ring->owned.store(true, memory_order_relaxed);
+                owner.ring = ring;
+                break;
+            }
+        }
+        if (owner.ring == nullptr) {
+            owner.ring = new LogRing();
+            rings.push_back(owner.ring);
+        }
+        if (!worker.joinable()) worker = thread(&Logger::workerLoop, this);
+        return owner.ring;
+    }
+
+    void wakeWorker() {
+        lock_guard<mutex> lock(mtx);
+        wakeRequested = true;
+        wake.notify_one();
+    }
+
+    static void format(OutputBuffer& out, const LogRecord& r) {
+        string_view plate(r.plate, min<size_t>(r.plateLength, sizeof(r.plate)));
+        auto appendPlate = [&] {
+            out.append(plate);
+            if (r.plateLength > sizeof(r.plate)) out.append("...");
+        };
+        switch (r.event) {
+            case LOG_PARKED:
+                out.append(vehicleKindName(r.kind));
+                out.append(" (");
+                appendPlate();
+                out.append(") parked successfully.\n");
+                break;
+            case LOG_LOT_FULL:
+                out.append("Parking Lot is Full! ");
+                appendPlate();
+                out.append(" cannot enter.\n");
+                break;
+            case LOG_PLATE_TOO_LONG:
+                out.append(">> ERROR: License plate ");
+                appendPlate();
+                out.append(" is too long (max ");
+                out.appendUint(MAX_PLATE_LENGTH);
+                out.append(" characters).\n");
+                break;
+            case LOG_DUPLICATE:
+                out.append(">> ERROR: Vehicle with plate ");
+                appendPlate();
+                out.append(" is already parked!\n");
+                break;
+            case LOG_NOT_FOUND:
+                out.append(">> ERROR: Vehicle with plate ");
+                appendPlate();
+                out.append(" not found!\n");
+                break;
+            case LOG_RECEIPT:
+                out.append("\n---------------------------------\n[EXIT] ");
+                appendPlate();
+                out.append(" is leaving.\nVehicle Type: ");
+                out.append(vehicleKindName(r.kind));
+                out.append("\nTotal Fee: $");
+                out.appendCents(r.value);
+                out.append("\n---------------------------------\n\n");
+                break;
+            case LOG_GATE_CONNECTED:
+                out.append("[debug] Gate connection ");
+                out.appendInt(r.socket);
+                out.append(" opened.\n");
+                break;
+            case LOG_GATE_DISCONNECTED:
+                out.append("[debug] Gate connection ");
+                out.appendInt(r.socket);
+                out.append(" closed after ");
+                out.appendInt(r.value);
+                out.append(" commands.\n");
+                break;
+        }
+    }
+
+    void workerLoop() {
+        OutputBuffer out(STDOUT_FILENO);
+        vector<LogRing*> active;
+        auto formatRecord = [&out](const LogRecord& r) { format(out, r); };
+
+        unique_lock<mutex> lock(mtx);
+        while (true) {
+            uint64_t requested = flushRequests;
+            active.clear();
+            active = rings;
+            lock.unlock();
+
+            size_t drained = 0;
+            for (LogRing* ring : active) drained += ring->drain(formatRecord);
+            out.flush();
+
+            lock.lock();
+            // Everything logged before flush() was called is written now.
+            flushedRequests = requested;
+            flushed.notify_all();
+            if (drained > 0) continue;
+            if (stopping) break;
+
+            // Producers only take the lock to wake us while 'sleeping' is set;
+            // the seq_cst store/load pairs make sure a record is never missed.
+            sleeping.store(true, memory_order_seq_cst);
+            bool idle = true;
+            for (LogRing* ring : active) idle = idle && ring->empty();
+            if (idle && rings.size() == active.size()) {
+                wake.wait(lock, [this] { return wakeRequested || stopping || flushRequests != flushedRequests; });
+            }
+            sleeping.store(false, memory_order_relaxed);
+            wakeRequested = false;
+        }
+    }
+
+public:
+    Logger() : stopping(false), wakeRequested(false), flushRequests(0), flushedRequests(0), sleeping(false) {}
+
+    ~Logger() {
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+            wake.notify_one();
+        }
+        if (worker.joinable()) worker.join();
+        for (LogRing* ring : rings) delete ring;
+    }
+
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    // Copies the record into the calling thread's ring. Only waits if the
+    // ring is full, i.e. the logger thread is 1024 records behind.
+    void write(LogLevel level, LogEvent event, uint8_t kind, string_view plate, int32_t socket, int64_t value) {
+        LogRecord record;
+        record.level = level;
+        record.event = event;
+        record.kind = kind;
+        record.plateLength = (uint8_t)min<size_t>(plate.size(), 255);
+        record.socket = socket;
+        record.value = value;
+        memcpy(record.plate, plate.data(), min(plate.size(), sizeof(record.plate)));
+
+        LogRing* ring = threadRing();
+        while (!ring->push(record)) {
+            wakeWorker();
+            this_thread::yield();
+        }
+        if (sleeping.load(memory_order_seq_cst)) wakeWorker();
+    }
+
+    // Returns once everything this thread logged has been written, e.g.
+    // before the menu prints to the same terminal.
+    void flush() {
+        unique_lock<mutex> lock(mtx);
+        if (!worker.joinable()) return; // Nothing was ever logged
+        uint64_t request = ++flushRequests;
+        wake.notify_one();
+        flushed.wait(lock, [this, request] { return flushedRequests >= request; });
+    }
+};
+
+Logger gateLog;
+
+// Levels below PARKING_LOG_LEVEL compile to nothing.
+template <LogLevel level>
+inline void logMessage(LogEvent event, uint8_t kind, string_view plate, int32_t socket = -1, int64_t value = 0) {
+    if constexpr (level >= PARKING_LOG_LEVEL) gateLog.write(level, event, kind, plate, socket, value);
+}
+
+// ARROW IPC EXPORT
+// Writes the Arrow IPC file format (the ".arrow" / Feather v2 files analytics
+// engines read natively) without the Arrow library. The metadata is a handful
+// of FlatBuffers tables, built by the minimal builder below; column data is
+// copied into the message bodies as is.
+
+// Minimal FlatBuffers builder. Like the reference implementation it fills its
+// buffer from the back, so children are written before the tables pointing to
+// them; positions are given as distances from the end of the buffer.
+class FlatBufferBuilder {
+private:
+    vector<uint8_t> buf;
+    size_t head;                  // First used byte of 'buf'
+    size_t minAlign;
+    uint32_t tableStart;
+    vector<pair<uint16_t, uint32_t>> tableFields; // Field id, position of its value
+
+    void reserve(size_t n) {
+        while (head < n) {
+            size_t used = buf.size() - head;
+            vector<uint8_t> bigger(buf.size() * 2);
+            memcpy(bigger.data() + bigger.size() - used, buf.data() + head, used);
+            head = bigger.size() - used;
+            buf.swap(bigger);
+        }
+    }
+
+    void prepend(const void* data, size_t n) {
+        reserve(n);
+        head -= n;
+        memcpy(&buf[head], data, n);
+    }
+
+    void pad(size_t n) {
+        reserve(n);
+        head -= n;
+        memset(&buf[head], 0, n);
+    }
+
+public:
+    FlatBufferBuilder() : buf(1024), head(1024), minAlign(1), tableStart(0) {}
+
+    uint32_t size() const { return buf.size() - head; }
+
+    // Pads so that 'alignment' holds once 'additional' more bytes are written.
+    void prep(size_t alignment, size_t additional) {
+        minAlign = max(minAlign, alignment);
+        pad((~(size() + additional) + 1) & (alignment - 1));
+    }
+
+    template <typename T>
+    void push(T value) {
+        prep(sizeof(T), 0);
+        prepend(&value, sizeof(T));
+    }
+
+    // A uoffset pointing at an object written earlier.
+    void pushOffset(uint32_t target) {
+        prep(4, 0);
+        uint32_t relative = size() - target + 4;
+        prepend(&relative, 4);
+    }
+
+    uint32_t createString(string_view s) {
+        prep(4, s.size() + 1);
+        pad(1); // NUL terminator
+        prepend(s.data(), s.size());
+        push<uint32_t>(s.size());
+        return size();
+    }
+
+    uint32_t createOffsetVector(const vector<uint32_t>& targets) {
+        prep(4, targets.size() * 4);
+        for (size_t i = targets.size(); i-- > 0;) pushOffset(targets[i]);
+        push<uint32_t>(targets.size());
+        return size();
+    }
+
+    uint32_t createStructVector(const void* data, size_t count, size_t elementSize, size_t alignment) {
+        prep(4, count * elementSize);
+        prep(alignment, count * elementSize);
+        prepend(data, count * elementSize);
+        push<uint32_t>(count);
+        return size();
+    }
+
+    void startTable() {
+        tableFields.clear();
+        tableStart = size();
+    }
+
+    template <typename T>
+    void addField(uint16_t field, T value) {
+        push(value);
+        tableFields.push_back({field, size()});
+    }
+
+    void addOffsetField(uint16_t field, uint32_t target) {
+        pushOffset(target);
+        tableFields.push_back({field, size()});
+    }
+
+    // Writes the table's vtable right before it (no vtable sharing).
+    uint32_t endTable() {
+        push<int32_t>(0); // Offset to the vtable, patched below
+        uint32_t table = size();
+
+        uint16_t fieldCount = 0;
+        for (const auto& field : tableFields) fieldCount = max<uint16_t>(fieldCount, field.first + 1);
+        vector<uint16_t> vtable(2 + fieldCount, 0);
+        vtable[0] = vtable.size() * sizeof(uint16_t);
+        vtable[1] = table - tableStart;
+        for (const auto& field : tableFields) vtable[2 + field.first] = table - field.second;
+        for (size_t i = vtable.size(); i-- > 0;) push<uint16_t>(vtable[i]);
+
+        int32_t toVtable = (int32_t)(size() - table);
+        memcpy(&buf[buf.size() - table], &toVtable, 4);
+        return table;
+    }
+
+    // Adds the root offset and returns the finished buffer.
+    vector<uint8_t> finish(uint32_t root) {
+        prep(minAlign, 4);
+        pushOffset(root);
+        return vector<uint8_t>(buf.begin() + head, buf.end());
+    }
+};
+
+enum ArrowColumnType {
+    ARROW_INT32,
+    ARROW_INT64,
+    ARROW_TIMESTAMP,      // int64 seconds since the epoch, UTC
+    ARROW_DICT_INT8,      // Utf8 dictionary column with int8 indices
+    ARROW_DICT_INT32      // Utf8 dictionary column with int32 indices
+};
+
+struct ArrowField {
+    const char* name;
+    ArrowColumnType type;
+    int64_t dictionaryId;   // Dictionary columns only
+};
+
+// Arrow type names used for the vehicle type column; indices are VehicleKind.
+const vector<string> ARROW_TYPE_DICTIONARY = {"Car", "Truck", "Motorbike"};
+
+// Writes one Arrow IPC file: schema, record batches added one at a time,
+// dictionaries (written last; the file footer lists them, so readers load
+// them first) and the footer. Columns never contain nulls.
+class ArrowFileWriter {
+private:
+    // FlatBuffers enum values and struct layouts from the Arrow format spec.
+    enum { METADATA_V5 = 4 };
+    enum { HEADER_SCHEMA = 1, HEADER_DICTIONARY_BATCH = 2, HEADER_RECORD_BATCH = 3 };
+    enum { TYPE_INT = 2, TYPE_UTF8 = 5, TYPE_TIMESTAMP = 10 };
+
+    struct Block {
+        int64_t offset;
+        int32_t metaDataLength;
+        int32_t padding;
+        int64_t bodyLength;
+    };
+    struct FieldNode {
+        int64_t length;
+        int64_t nullCount;
+    };
+    struct BufferSpec {
+        int64_t offset;
+        int64_t length;
+    };
+
+    OutputBuffer& out;
+    uint64_t position;
+    vector<ArrowField> fields;
+    vector<Block> dictionaryBlocks;
+    vector<Block> batchBlocks;
+
+    // Current batch, reused between batches.
+    int64_t batchRows;
+    vector<char> body;
+    vector<FieldNode> nodes;
+    vector<BufferSpec> buffers;
+
+    void write(const void* data, size_t n) {
+        out.append(static_cast<const char*>(data), n);
+        position += n;
+    }
+
+    void addBuffer(const void* data, size_t n) {
+        buffers.push_back({(int64_t)body.size(), (int64_t)n});
+        const char* bytes = static_cast<const char*>(data);
+        body.insert(body.end(), bytes, bytes + n);
+        body.resize((body.size() + 7) & ~(size_t)7, 0);
+    }
+
+    uint32_t buildInt(FlatBufferBuilder& fb, int bitWidth) {
+        fb.startTable();
+        fb.addField<int32_t>(0, bitWidth);
+        fb.addField<uint8_t>(1, 1); // Signed
+        return fb.endTable();
+    }
+
+    uint32_t buildSchema(FlatBufferBuilder& fb) {
+        vector<uint32_t> fieldTables;
+        for (const ArrowField& field : fields) {
+            uint32_t name = fb.createString(field.name);
+            uint32_t children = fb.createOffsetVector({});
+            uint8_t typeType;
+            uint32_t type;
+            uint32_t dictionary = 0;
+            if (field.type == ARROW_INT32 || field.type == ARROW_INT64) {
+                typeType = TYPE_INT;
+                type = buildInt(fb, field.type == ARROW_INT32 ? 32 : 64);
+            } else if (field.type == ARROW_TIMESTAMP) {
+                uint32_t timezone = fb.createString("UTC");
+                fb.startTable();
+                fb.addField<int16_t>(0, 0); // TimeUnit.SECOND
+                fb.addOffsetField(1, timezone);
+                typeType = TYPE_TIMESTAMP;
+                type = fb.endTable();
+            } else {
+                uint32_t indexType = buildInt(fb, field.type == ARROW_DICT_INT8 ? 8 : 32);
+                fb.startTable();
+                fb.addField<int64_t>(0, field.dictionaryId);
+                fb.addOffsetField(1, indexType);
+                dictionary = fb.endTable();
+                fb.startTable();
+                typeType = TYPE_UTF8;
+                type = fb.endTable();
+            }
+
+            fb.startTable();
+            fb.addOffsetField(0, name);
+            fb.addField<uint8_t>(1, 0); // Not nullable
+            fb.addField<uint8_t>(2, typeType);
+            fb.addOffsetField(3, type);
+            if (dictionary != 0) fb.addOffsetField(4, dictionary);
+            fb.addOffsetField(5, children);
+            fieldTables.push_back(fb.endTable());
+        }
+        uint32_t fieldVector = fb.createOffsetVector(fieldTables);
+        fb.startTable();
+        fb.addField<int16_t>(0, 0); // Little endian
+        fb.addOffsetField(1, fieldVector);
+        return fb.endTable();
+    }
+
+    uint32_t buildRecordBatch(FlatBufferBuilder& fb) {
+        uint32_t nodeVector = fb.createStructVector(nodes.data(), nodes.size(), sizeof(FieldNode), 8);
+        uint32_t bufferVector = fb.createStructVector(buffers.data(), buffers.size(), sizeof(BufferSpec), 8);
+        fb.startTable();
+        fb.addField<int64_t>(0, batchRows);
+        fb.addOffsetField(1, nodeVector);
+        fb.addOffsetField(2, bufferVector);
+        return fb.endTable();
+    }
+
+    // Frames a message: continuation marker, metadata size, the Message
+    // flatbuffer padded to 8 bytes, then the body.
+    Block writeMessage(FlatBufferBuilder& fb, uint8_t headerType, uint32_t header, const vector<char>& messageBody) {
+        fb.startTable();
+        fb.addField<int16_t>(0, METADATA_V5);
+        fb.addField<uint8_t>(1, headerType);
+        fb.addOffsetField(2, header);
+        fb.addField<int64_t>(3, (int64_t)messageBody.size());
+        vector<uint8_t> metadata = fb.finish(fb.endTable());
+
+        Block block;
+        block.offset = position;
+        block.padding = 0;
+        block.bodyLength = messageBody.size();
+        int32_t metadataSize = (metadata.size() + 8 + 7) / 8 * 8 - 8;
+        block.metaDataLength = metadataSize + 8;
+
+        uint32_t continuation = 0xFFFFFFFF;
+        char zeros[8] = {0};
+        write(&continuation, 4);
+        write(&metadataSize, 4);
+        write(metadata.data(), metadata.size());
+        write(zeros, metadataSize - metadata.size());
+        write(messageBody.data(), messageBody.size());
+        return block;
+    }
+
+public:
+    ArrowFileWriter(OutputBuffer& out, const vector<ArrowField>& fields)
+        : out(out), position(0), fields(fields), batchRows(0) {
+        write("ARROW1\0\0", 8);
+        FlatBufferBuilder fb;
+        writeMessage(fb, HEADER_SCHEMA, buildSchema(fb), vector<char>());
+    }
+
+    void beginBatch(int64_t rows) {
+        batchRows = rows;
+        body.clear();
+        nodes.clear();
+        buffers.clear();
+    }
+
+    // Adds the next column of the batch: 'batchRows' values of 'byteWidth'
+    // bytes each (dictionary columns take their indices).
+    void addColumn(const void* values, size_t byteWidth) {
+        nodes.push_back({batchRows, 0});
+        addBuffer(nullptr, 0); // No validity bitmap: no nulls
+        addBuffer(values, batchRows * byteWidth);
+    }
+
+    void endBatch() {
+        FlatBufferBuilder fb;
+        batchBlocks.push_back(writeMessage(fb, HEADER_RECORD_BATCH, buildRecordBatch(fb), body));
+    }
+
+    void writeDictionary(int64_t id, const vector<string>& values) {
+        vector<int32_t> offsets(1, 0);
+        string data;
+        for (const string& value : values) {
+            data += value;
+            offsets.push_back(data.size());
+        }
+        beginBatch(values.size());
+        nodes.push_back({batchRows, 0});
+        addBuffer(nullptr, 0);
+        addBuffer(offsets.data(), offsets.size() * sizeof(int32_t));
+        addBuffer(data.data(), data.size());
+
+        FlatBufferBuilder fb;
+        uint32_t batch = buildRecordBatch(fb);
+        fb.startTable();
+        fb.addField<int64_t>(0, id);
+        fb.addOffsetField(1, batch);
+        fb.addField<uint8_t>(2, 0); // Not a delta
+        dictionaryBlocks.push_back(writeMessage(fb, HEADER_DICTIONARY_BATCH, fb.endTable(), body));
+    }
+
+    // Writes the footer. Returns false if any write failed.
+    bool finish() {
+        FlatBufferBuilder fb;
+        uint32_t schema = buildSchema(fb);
+        uint32_t dictionaries = fb.createStructVector(dictionaryBlocks.data(), dictionaryBlocks.size(), sizeof(Block), 8);
+        uint32_t batches = fb.createStructVector(batchBlocks.data(), batchBlocks.size(), sizeof(Block), 8);
+        fb.startTable();
+        fb.addField<int16_t>(0, METADATA_V5);
+        fb.addOffsetField(1, schema);
+        fb.addOffsetField(2, dictionaries);
+        fb.addOffsetField(3, batches);
+        vector<uint8_t> footer = fb.finish(fb.endTable());
+
+        int32_t footerSize = footer.size();
+        write(footer.data(), footer.size());
+        write(&footerSize, 4);
+        write("ARROW1", 6);
+        return out.flush();
+    }
+};
+
+// File names used for persistence.
+const char* const DATA_FILE = "parking_data.txt";   // Legacy text snapshot, read if no binary one exists
+const char* const SNAPSHOT_FILE = "parking_data.bin";
+const char* const JOURNAL_FILE = "parking_journal.bin";
+const char* const JOURNAL_OLD_FILE = "parking_journal.old"; // Segment being checkpointed
+const char* const HISTORY_FILE = "parking_history.bin";     // Completed sessions
+
+// Lowers the calling thread's CPU (nice 10) and disk (lowest best-effort
+// class) priority, so background compaction only uses capacity the gates
+// leave over. Not the idle classes: a busy lot must not starve it, or the
+// journal would grow without bound.
+void lowerThreadPriority() {
+    const int IOPRIO_WHO_PROCESS = 1, IOPRIO_CLASS_BE = 2, IOPRIO_CLASS_SHIFT = 13;
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    if (setpriority(PRIO_PROCESS, tid, 10) != 0
+        || syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | 7) != 0) {
+        cerr << "Warning: Could not lower checkpoint thread priority." << endl;
+    }
+}
+
+// Persistence settings of a ParkingLot.
+struct StorageOptions {
+    JournalOptions journal;
+    // A background checkpoint (snapshot) is taken after this many journaled
+    // events or this many seconds, whichever comes first. This keeps the
+    // journal, and therefore the replay at startup, bounded.
+    int checkpointIntervalEvents = 1000;
+    int checkpointIntervalSeconds = 60;
+    // Serve vehicles straight from the mapped snapshot and only copy the ones
+    // that gate operations touch. Startup time no longer depends on lot size.
+    bool lazyLoad = false;
+    // Off for throwaway lots (trace replay): no files are read or written
+    // and no checkpoint thread is started.
+    bool persistent = true;
+};
+
+// Outcome of a gate operation, for callers that report it themselves.
+enum ParkStatus { PARK_OK, PARK_FULL, PARK_PLATE_TOO_LONG, PARK_DUPLICATE };
+
+struct ParkResult {
+    ParkStatus status;
+    int spot;       // Assigned spot, -1 unless PARK_OK
+    uint64_t lsn;   // Journal sequence number of the park event (0 without a journal)
+};
+
+struct UnparkResult {
+    bool found;
+    uint8_t kind;   // VehicleKind of the departed vehicle
+    int spot;
+    double fee;
+    uint64_t lsn;   // Journal sequence number of the unpark event (0 for a quote)
+};
+
+struct LotSummary {
+    int occupied;
+    int capacity;
+    double revenue;
+};
+
+// Order of a status query page.
+enum StatusSortKey { SORT_SPOT, SORT_ENTRY_TIME, SORT_PLATE, SORT_FEE };
+
+// Filter, order and page of a status query. Defaults list the first 20
+// vehicles in spot order.
+struct StatusQuery {
+    uint8_t kind = KIND_UNKNOWN;     // KIND_UNKNOWN matches every type
+    string platePrefix;
+    int64_t minDwellSeconds = 0;
+    StatusSortKey sortBy = SORT_SPOT;
+    bool descending = false;         // Ignored for SORT_SPOT
+    size_t offset = 0;
+    size_t limit = 20;
+};
+
+struct StatusRow {
+    int spot;
+    uint8_t kind;
+    string plate;
+    time_t entryTime;
+    double fee;       // Fee if the vehicle left at the query time
+};
+
+struct StatusPage {
+    vector<StatusRow> rows;
+    int64_t matched;  // Vehicles matching the filter, -1 if a spot order scan stopped early
+    bool hasMore;     // More matches follow this page
+};
+
+// This class manages the parking operations using a collection of Vehicle objects.
+class ParkingLot {
+private:
+    // Storage: One slot per parking spot, nullptr marks a free spot.
+    // We use pointers (Vehicle*) to store derived objects (Car, Truck) in the same list.
+    vector<Vehicle*> parkedVehicles;
+    PlateIndex plateIndex;                 // License plate -> spot, O(1) lookup
+    vector<int> freeSpots;                 // Stack of freed spots (may contain stale entries)
+    int nextUnusedSpot;                    // Spots from here on were never handed out
+    int occupiedCount;
+
+    // Lazy loading: vehicles of the startup snapshot stay in the mapped file
+    // until a gate operation touches them. Their spots count as occupied
+    // while parkedVehicles holds nullptr and baseReplaced is false.
+    MappedSnapshot baseSnapshot;
+    vector<bool> baseReplaced;             // Spot no longer reflects baseSnapshot
+    bool lazyBase;
+    bool dirtyCoversBase;                  // dirtyPages holds every change since the base was loaded
+
+    const int capacity;     // Max limit for car park
+    double totalRevenue;    // total revenue
+    const Tariff* tariff;   // nullptr: every vehicle prices itself
+
+    // Guards everything above, so gates on several threads can park/unpark
+    // concurrently and their journal records end up in one group commit.
+    mutex lotMutex;
+
+    // Persistence state
+    Journal journal;
+    StorageOptions storageOptions;
+    uint64_t snapshotLsn;    // Last journal record already contained in the snapshot
+    uint64_t oldSegmentLsn;  // Last journal record in JOURNAL_OLD_FILE, if it exists
+    IncrementalSnapshot snapshotFile;
+    IoRing checkpointRing;   // io_uring for incremental checkpoints (--io-backend=uring)
+    vector<uint64_t> dirtyPages;   // Bit per snapshot record page changed since the last checkpoint
+    HistoryArchive history;  // Completed sessions, buffered until the next checkpoint
+
+    // Background checkpointing. The wait uses lotMutex, which also guards the
+    // counters below.
+    thread checkpointer;
+    mutex checkpointMutex;              // Only one checkpoint runs at a time
+    condition_variable checkpointWake;
+    int eventsSinceCheckpoint;
+    bool checkpointRequested;
+    bool stopCheckpointer;
+
+    // The saved vehicles do not fit into 'capacity'. The lot must not be used:
+    // a checkpoint would write the smaller lot over the data files.
+    bool overCapacity;
+
+    // True if the spot still holds an unmaterialized vehicle of the lazy base.
+    bool inBase(int spot) const {
+        return lazyBase && (uint64_t)spot < baseSnapshot.info().recordCount && !baseReplaced[spot]
+            && baseSnapshot.record(spot).kind <= KIND_MOTORBIKE;
+    }
+
+    bool isFree(int spot) const {
+        return parkedVehicles[spot] == nullptr && !inBase(spot);
+    }
+
+    // Spot of a parked vehicle or -1; checks the mapped base index as well.
+    int findSpot(const string& plate) const {
+        int spot = plateIndex.find(plate);
+        if (spot >= 0 || !lazyBase) return spot;
+        int64_t baseSpot = baseSnapshot.findPlate(plate);
+        return (baseSpot >= 0 && inBase(baseSpot)) ? (int)baseSpot : -1;
+    }
+
+    // Returns the vehicle in an occupied spot, copying it out of the mapped
+    // base first if needed. The file contents do not change, so the spot is
+    // not marked dirty.
+    Vehicle* vehicleAt(int spot) {
+        if (parkedVehicles[spot] == nullptr && inBase(spot)) {
+            const SnapshotRecord& rec = baseSnapshot.record(spot);
+            Vehicle* v = createVehicle(rec.kind, string(rec.plate, strnlen(rec.plate, sizeof(rec.plate))), rec.entryTime);
+            baseReplaced[spot] = true;
+            parkedVehicles[spot] = v;
+            plateIndex.insert(v->getLicensePlate(), spot);
+        }
+        return parkedVehicles[spot];
+    }
+
+    // Copies every remaining base vehicle into the table (before bulk changes
+    // that bypass the gate operations, like a text import).
+    void materializeAll() {
+        if (!lazyBase) return;
+        for (int spot = 0; spot < capacity; spot++) vehicleAt(spot);
+        lazyBase = false;
+    }
+
+    // Calls 'f' for every parked vehicle in spot order. Vehicles still in the
+    // lazy base are passed as temporary objects and stay unmaterialized.
+    void forEachVehicle(const function<void(Vehicle*)>& f) {
+        for (int spot = 0; spot < capacity; spot++) {
+            if (parkedVehicles[spot] != nullptr) {
+                f(parkedVehicles[spot]);
+            } else if (inBase(spot)) {
+                const SnapshotRecord& rec = baseSnapshot.record(spot);
+                Vehicle* v = createVehicle(rec.kind, string(rec.plate, strnlen(rec.plate, sizeof(rec.plate))), rec.entryTime);
+                if (v != nullptr) f(v);
+                delete v;
+            }
+        }
+    }
+
+    void markDirty(int spot) {
+        uint64_t page = spot / SNAPSHOT_RECORDS_PER_PAGE;
+        dirtyPages[page / 64] |= 1ULL << (page % 64);
+    }
+
+    // Puts a vehicle into a specific (free) spot and indexes it.
+    void placeVehicle(int spot, Vehicle* v) {
+        markDirty(spot);
+        if (lazyBase) baseReplaced[spot] = true;
+        parkedVehicles[spot] = v;
+        plateIndex.insert(v->getLicensePlate(), spot);
+        occupiedCount++;
+    }
+
+    // Takes the vehicle out of its spot and returns it (caller deletes it).
+    Vehicle* removeVehicle(int spot) {
+        Vehicle* v = vehicleAt(spot);
+        markDirty(spot);
+        plateIndex.erase(v->getLicensePlate());
+        parkedVehicles[spot] = nullptr;
+        freeSpots.push_back(spot);
+        occupiedCount--;
+        return v;
+    }
+
+    // Reuses the most recently freed spot, otherwise the lowest spot never
+    // handed out. Entries become stale when replay places a vehicle into a
+    // specific spot, and loaded vehicles are skipped by the scan.
+    int takeFreeSpot() {
+        while (!freeSpots.empty()) {
+            int spot = freeSpots.back();
+            freeSpots.pop_back();
+            if (isFree(spot)) return spot;
+        }
+        while (nextUnusedSpot < capacity) {
+            int spot = nextUnusedSpot++;
+            if (isFree(spot)) return spot;
+        }
+        return -1;
+    }
+
+    // Appends a park/unpark event to the journal and wakes the checkpointer
+    // when enough events have piled up. Returns the record's sequence number
+    // (0 if there is no journal).
+    uint64_t logEvent(JournalOp op, Vehicle* v, int spot, time_t when, double fee) {
+        if (!journal.isOpen()) return 0;
+
+        JournalRecord rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.op = op;
+        rec.kind = vehicleKindFromName(v->getType());
+        rec.spot = spot;
+        rec.timestamp = when;
+        rec.fee = fee;
+        memcpy(rec.plate, v->getLicensePlate().data(), v->getLicensePlate().size());
+
+        uint64_t lsn = journal.append(rec);
+
+        if (++eventsSinceCheckpoint == storageOptions.checkpointIntervalEvents) {
+            checkpointWake.notify_one();
+        }
+        return lsn;
+    }
+
+    // Re-applies one journaled event during startup recovery.
+    void applyJournalRecord(const JournalRecord& rec) {
+        string plate(rec.plate, strnlen(rec.plate, sizeof(rec.plate)));
+
+        if (rec.op == JOURNAL_PARK) {
+            if (findSpot(plate) >= 0) return;
+            if (occupiedCount >= capacity) {
+                overCapacity = true;
+                return;
+            }
+            Vehicle* v = createVehicle(rec.kind, plate, rec.timestamp);
+            if (v == nullptr) return;
+
+            // Prefer the recorded spot; the text snapshot does not keep spot numbers,
+            // so it may already be taken by a vehicle loaded from the snapshot.
+            int spot = rec.spot;
+            if (spot < 0 || spot >= capacity || !isFree(spot)) {
+                spot = takeFreeSpot();
+            }
+            placeVehicle(spot, v);
+        } else if (rec.op == JOURNAL_UNPARK) {
+            int spot = findSpot(plate);
+            if (spot < 0) return;
+            Vehicle* v = removeVehicle(spot);
+            totalRevenue += rec.fee;
+            // Sessions that were still buffered when the program stopped.
+            if (rec.lsn > history.recordedLsn()) {
+                history.append(rec.lsn, plate, rec.kind, v->getEntryTime(), rec.timestamp, rec.fee);
+            }
+            delete v;
+        }
+    }
+
+    void fillRecord(int spot, SnapshotRecord& rec) const {
+        if (parkedVehicles[spot] == nullptr && inBase(spot)) {
+            rec = baseSnapshot.record(spot);
+            return;
+        }
+        memset(&rec, 0, sizeof(rec));
+        rec.kind = KIND_UNKNOWN;
+
+        Vehicle* v = parkedVehicles[spot];
+        if (v != nullptr) {
+            packPlate(v->getLicensePlate(), rec.plate);
+            rec.entryTime = v->getEntryTime();
+            rec.kind = vehicleKindFromName(v->getType());
+        }
+    }
+
+    // Copies the spot table into a SnapshotImage: only the pages changed since
+    // the last checkpoint if 'dirtyOnly', the whole table otherwise. Called
+    // with lotMutex held; this is the only part of a checkpoint that gate
+    // operations wait for.
+    SnapshotImage captureSnapshot(bool dirtyOnly) {
+        SnapshotImage image;
+        image.full = !dirtyOnly;
+        if (dirtyOnly) {
+            for (size_t word = 0; word < dirtyPages.size(); word++) {
+                for (uint64_t bits = dirtyPages[word]; bits != 0; bits &= bits - 1) {
+                    uint64_t page = word * 64 + __builtin_ctzll(bits);
+                    image.pages.push_back(page);
+                    int first = page * SNAPSHOT_RECORDS_PER_PAGE;
+                    int last = min<int>(first + SNAPSHOT_RECORDS_PER_PAGE, capacity);
+                    for (int spot = first; spot < last; spot++) {
+                        image.records.emplace_back();
+                        fillRecord(spot, image.records.back());
+                    }
+                }
+            }
+        } else {
+            image.records.resize(capacity);
+            for (int spot = 0; spot < capacity; spot++) fillRecord(spot, image.records[spot]);
+        }
+        fill(dirtyPages.begin(), dirtyPages.end(), 0);
+        dirtyCoversBase = false;
+
+        image.recordCount = capacity;
+        image.occupied = occupiedCount;
+        image.lsn = journal.lastLsn();
+        image.revenue = totalRevenue;
+        return image;
+    }
+
+    // Turns an image of the pages changed since a lazy load into a full one,
+    // taking every other page from the mapped base. The mapping never changes,
+    // so this runs without lotMutex.
+    SnapshotImage mergeWithBase(const SnapshotImage& changes) const {
+        SnapshotImage image;
+        image.recordCount = changes.recordCount;
+        image.occupied = changes.occupied;
+        image.lsn = changes.lsn;
+        image.revenue = changes.revenue;
+
+        uint64_t baseCount = min<uint64_t>(baseSnapshot.info().recordCount, image.recordCount);
+        image.records.resize(image.recordCount);
+        memcpy(image.records.data(), &baseSnapshot.record(0), baseCount * sizeof(SnapshotRecord));
+        for (uint64_t spot = baseCount; spot < image.recordCount; spot++) {
+            memset(&image.records[spot], 0, sizeof(SnapshotRecord));
+            image.records[spot].kind = KIND_UNKNOWN;
+        }
+
+        const SnapshotRecord* changed = changes.records.data();
+        for (uint64_t page : changes.pages) {
+            uint64_t first = page * SNAPSHOT_RECORDS_PER_PAGE;
+            uint64_t count = min(SNAPSHOT_RECORDS_PER_PAGE, image.recordCount - first);
+            memcpy(&image.records[first], changed, count * sizeof(SnapshotRecord));
+            changed += count;
+        }
+        return image;
+    }
+
+    // Writes a new snapshot and compacts the journal into it. The lot is
+    // locked only to copy the changed pages and to mark where the journal is
+    // cut, both proportional to the changes since the last checkpoint; the
+    // rotation, file writes and fsyncs happen afterwards, so park and unpark
+    // keep going meanwhile. Journal records appended during the write land in
+    // the new journal file, the rotated one is deleted once the snapshot
+    // covering it is safely on disk.
+    bool checkpoint() {
+        if (overCapacity) return false;
+        lock_guard<mutex> serial(checkpointMutex);
+
+        SnapshotImage image;
+        vector<PendingHistoryBlock> historyBlocks;
+        bool fromBase, rotating;
+        uint64_t cut = 0;
+        {
+            lock_guard<mutex> lock(lotMutex);
+            bool incremental = snapshotFile.canUpdate(capacity);
+            fromBase = !incremental && lazyBase && dirtyCoversBase;
+            image = captureSnapshot(incremental || fromBase);
+            historyBlocks = history.takeBlocks();
+            rotating = journal.requestRotation(JOURNAL_OLD_FILE);
+            if (rotating) cut = journal.lastLsn();
+            eventsSinceCheckpoint = 0;
+            checkpointRequested = false;
+        }
+
+        if (fromBase) image = mergeWithBase(image);
+        if (rotating && journal.waitRotation()) oldSegmentLsn = cut;
+
+        // History goes first: once the journal segment is gone, it is the only
+        // record of the sessions completed in it.
+        bool historyWritten = history.writeBlocks(historyBlocks);
+        bool written = historyWritten
+            && (image.full ? snapshotFile.writeFull(image, SNAPSHOT_FILE) : snapshotFile.writePages(image));
+        if (!written) {
+            // The pages taken out of the dirty set are lost; start over with a
+            // full snapshot. Unwritten history rows are kept for the next try.
+            snapshotFile.detach();
+            if (!historyWritten) {
+                lock_guard<mutex> lock(lotMutex);
+                history.restoreBlocks(historyBlocks);
+            }
+            cerr << "Error: Could not write checkpoint." << endl;
+            return false;
+        }
+        uint64_t oldestBuffered;
+        {
+            lock_guard<mutex> lock(lotMutex);
+            oldestBuffered = history.oldestBufferedLsn();
+        }
+        if (oldestBuffered > oldSegmentLsn) unlink(JOURNAL_OLD_FILE);
+        snapshotLsn = image.lsn;
+        return true;
+    }
+
+    // Writes the buffered history rows. The caller holds checkpointMutex, which
+    // keeps blocks from different calls in order.
+    bool writeHistory() {
+        vector<PendingHistoryBlock> blocks;
+        {
+            lock_guard<mutex> lock(lotMutex);
+            blocks = history.takeBlocks();
+        }
+        if (history.writeBlocks(blocks)) return true;
+        lock_guard<mutex> lock(lotMutex);
+        history.restoreBlocks(blocks);
+        return false;
+    }
+
+    // Background thread: checkpoints on the event-count or time schedule.
+    void checkpointLoop() {
+        lowerThreadPriority();
+        unique_lock<mutex> lock(lotMutex);
+        while (!stopCheckpointer) {
+            checkpointWake.wait_for(lock, chrono::seconds(storageOptions.checkpointIntervalSeconds), [this] {
+                return stopCheckpointer || checkpointRequested
+                    || eventsSinceCheckpoint >= storageOptions.checkpointIntervalEvents;
+            });
+            if (stopCheckpointer) break;
+            if (eventsSinceCheckpoint == 0 && !checkpointRequested) continue;
+
+            lock.unlock();
+            checkpoint();
+            lock.lock();
+        }
+    }
+
+public:
+    // Loads previous data from file upon startup.
+    ParkingLot(int capacity = 7, StorageOptions options = StorageOptions())
+        : nextUnusedSpot(0), occupiedCount(0), lazyBase(false), dirtyCoversBase(false), capacity(capacity), totalRevenue(0.0), tariff(nullptr),
+          storageOptions(options), snapshotLsn(0), oldSegmentLsn(0), eventsSinceCheckpoint(0),
+          checkpointRequested(false), stopCheckpointer(false), overCapacity(false) {
+        parkedVehicles.assign(capacity, nullptr);
+        dirtyPages.assign((capacity / SNAPSHOT_RECORDS_PER_PAGE + 64) / 64, 0);
+        if (storageOptions.persistent) {
+            if (storageOptions.journal.ioBackend == IO_URING) {
+                if (checkpointRing.init(256)) snapshotFile.useRing(&checkpointRing);
+                else cout << "Warning: io_uring is not available, using blocking I/O." << endl;
+            }
+            loadData(); 
+            if (!overCapacity) checkpointer = thread(&ParkingLot::checkpointLoop, this);
+        }
+    }
+
+    // Saves data and cleans up memory upon exit.
+    ~ParkingLot() {
+        if (storageOptions.persistent && !overCapacity) {
+            {
+                lock_guard<mutex> lock(lotMutex);
+                stopCheckpointer = true;
+            }
+            checkpointWake.notify_one();
+            checkpointer.join(); // Lets a running checkpoint finish
+
+            saveData(); 
+            journal.printStats(cout);
+            snapshotFile.printStats(cout);
+        }
+        
+        // Memory Cleanup: Delete all dynamically allocated vehicle objects
+        for (Vehicle* v : parkedVehicles) {
+            delete v; 
+        }
+        parkedVehicles.clear();
+    }
+
+    // Method: Park a new vehicle (no console output, used by the batch runner)
+    // Takes ownership of 'newVehicle'; it is deleted unless the result is PARK_OK.
+    // Without 'waitForDisk' a STRICT caller must wait for result.lsn itself
+    // (see whenDurable()) before confirming the park.
+    ParkResult park(Vehicle* newVehicle, bool waitForDisk = true) {
+        ParkResult result = {PARK_OK, -1, 0};
+        {
+            lock_guard<mutex> lock(lotMutex);
+            const string& plate = newVehicle->getLicensePlate();
+
+            if (occupiedCount >= capacity) {
+                result.status = PARK_FULL;
+            } else if (plate.size() > MAX_PLATE_LENGTH) {
+                result.status = PARK_PLATE_TOO_LONG;
+            } else if (findSpot(plate) >= 0) {
+                result.status = PARK_DUPLICATE;
+            } else {
+                result.spot = takeFreeSpot();
+                placeVehicle(result.spot, newVehicle);
+                result.lsn = logEvent(JOURNAL_PARK, newVehicle, result.spot, newVehicle->getEntryTime(), 0.0);
+            }
+        }
+        if (result.status != PARK_OK) {
+            delete newVehicle; // Important: Delete the object since we are not storing it.
+            return result;
+        }
+
+        // STRICT durability: confirm only once the record is on disk. The lock is
+        // already released, so other gates keep going and share the same fsync.
+        if (waitForDisk) journal.waitDurable(result.lsn);
+        return result;
+    }
+
+    // Method: Remove a vehicle and calculate fee (no console output)
+    // 'exitTime' 0 means now; trace replays pass the recorded exit time.
+    UnparkResult unpark(const string& plate, time_t exitTime = 0, bool waitForDisk = true) {
+        UnparkResult result = {false, KIND_UNKNOWN, -1, 0.0, 0};
+        if (exitTime == 0) exitTime = time(0);
+        {
+            lock_guard<mutex> lock(lotMutex);
+
+            // Hash lookup instead of scanning every spot.
+            int spot = findSpot(plate);
+            if (spot < 0) return result;
+
+            Vehicle* v = vehicleAt(spot);
+            result.found = true;
+            result.kind = vehicleKindFromName(v->getType());
+            result.spot = spot;
+
+            // Polymorphism in action: correct calculateFee() is called based on object type.
+            result.fee = tariff ? tariff->fee(result.kind, v->getEntryTime(), exitTime) : v->calculateFee(exitTime);
+            totalRevenue += result.fee;
+
+            removeVehicle(spot);
+            result.lsn = logEvent(JOURNAL_UNPARK, v, spot, exitTime, result.fee);
+            history.append(result.lsn, plate, result.kind, v->getEntryTime(), exitTime, result.fee);
+            delete v; // Free the heap memory
+        }
+
+        if (waitForDisk) journal.waitDurable(result.lsn);
+        return result;
+    }
+
+    // Calls 'callback' from the journal writer once event 'lsn' is on disk;
+    // false (no call) if it already is or the durability mode is not STRICT.
+    bool whenDurable(uint64_t lsn, function<void()> callback) {
+        return journal.whenDurable(lsn, move(callback));
+    }
+
+    // Prices every later unpark and quote with 'pricing' (owned by the caller)
+    // instead of the vehicles' own rates; nullptr goes back to those.
+    void setTariff(const Tariff* pricing) {
+        lock_guard<mutex> lock(lotMutex);
+        tariff = pricing;
+    }
+
+    // Method: The fee a vehicle would pay if it left at 'at' (0: now); nothing changes.
+    UnparkResult quote(const string& plate, time_t at = 0) {
+        UnparkResult result = {false, KIND_UNKNOWN, -1, 0.0, 0};
+        lock_guard<mutex> lock(lotMutex);
+        int spot = findSpot(plate);
+        if (spot < 0) return result;
+
+        Vehicle* v = vehicleAt(spot);
+        result.found = true;
+        result.kind = vehicleKindFromName(v->getType());
+        result.spot = spot;
+        if (at == 0) at = time(0);
+        result.fee = tariff ? tariff->fee(result.kind, v->getEntryTime(), at) : v->calculateFee(at);
+        return result;
+    }
+
+    // False if the saved data did not fit into the lot. Such a lot writes
+    // nothing back, and the caller should not use it.
+    bool dataFits() const { return !overCapacity; }
+
+    // Takes a checkpoint now instead of waiting for the schedule.
+    bool checkpointNow() { return checkpoint(); }
+
+    // Occupancy and revenue without listing the vehicles.
+    LotSummary summary() {
+        lock_guard<mutex> lock(lotMutex);
+        return {occupiedCount, capacity, totalRevenue};
+    }
+
+    // Method: Park a new vehicle
+    // Accepts a base class pointer, allowing any derived vehicle type.
+
+    void parkVehicle(Vehicle* newVehicle) {
+        string plate = newVehicle->getLicensePlate();
+        VehicleKind kind = vehicleKindFromName(newVehicle->getType());
+
+        switch (park(newVehicle).status) {
+            case PARK_FULL:
+                logMessage<LOG_WARN>(LOG_LOT_FULL, kind, plate);
+                break;
+            case PARK_PLATE_TOO_LONG:
+                logMessage<LOG_ERROR>(LOG_PLATE_TOO_LONG, kind, plate);
+                break;
+            case PARK_DUPLICATE:
+                logMessage<LOG_ERROR>(LOG_DUPLICATE, kind, plate);
+                break;
+            case PARK_OK:
+                logMessage<LOG_INFO>(LOG_PARKED, kind, plate);
+                break;
+        }
+    }
+
+    // Method: Remove a vehicle and log the receipt
+    void unparkVehicle(string plate) {
+        UnparkResult result = unpark(plate);
+        if (!result.found) {
+            logMessage<LOG_ERROR>(LOG_NOT_FOUND, KIND_UNKNOWN, plate);
+            return;
+        }
+        logMessage<LOG_INFO>(LOG_RECEIPT, result.kind, plate, -1, llround(result.fee * 100));
+    }
+
+    // Method: Display status of the parking lot
+    void displayStatus() {
+        lock_guard<mutex> lock(lotMutex);
+        cout << "\n=== PARKING LOT STATUS (" << occupiedCount << "/" << capacity << ") ===" << endl;
+        cout << "Total Revenue: $" << totalRevenue << endl;
+        cout << "--------------------------------------------------------" << endl;
+        
+        if (occupiedCount == 0) {
+            cout << "Parking lot is currently empty." << endl;
+        } else {
+            forEachVehicle([](Vehicle* v) {
+                v->displayInfo(); // Polymorphism: Calls the correct display function
+            });
+        }
+        cout << "--------------------------------------------------------\n" << endl;
+    }
+
+    // Loads a binary snapshot through mmap. Records keep their spot numbers.
+    // With lazy loading the file stays mapped and nothing is read up front
+    // (unless the lot became smaller than the snapshot).
+    bool loadBinarySnapshot(const string& path) {
+        MappedSnapshot eagerSnapshot;
+        MappedSnapshot& snapshot = storageOptions.lazyLoad ? baseSnapshot : eagerSnapshot;
+        if (!snapshot.open(path)) return false;
+
+        const SnapshotHeader& header = snapshot.info();
+        if (header.occupied > (uint64_t)capacity) {
+            overCapacity = true;
+            return true;
+        }
+        snapshotLsn = header.lsn;
+        totalRevenue = header.revenue;
+
+        if (storageOptions.lazyLoad && header.recordCount <= (uint64_t)capacity) {
+            // Not attached for incremental checkpoints: the mapping must not
+            // change underneath, so the first checkpoint writes a new file.
+            lazyBase = true;
+            dirtyCoversBase = true;
+            baseReplaced.assign(capacity, false);
+            occupiedCount = header.occupied;
+            return true;
+        }
+
+        plateIndex.reserve(header.occupied);
+
+        vector<uint64_t> displaced; // Spots beyond the current capacity
+        for (uint64_t spot = 0; spot < header.recordCount; spot++) {
+            const SnapshotRecord& rec = snapshot.record(spot);
+            if (rec.kind == KIND_UNKNOWN) continue;
+            if (spot < (uint64_t)capacity) {
+                string plate(rec.plate, strnlen(rec.plate, sizeof(rec.plate)));
+                Vehicle* v = createVehicle(rec.kind, plate, rec.entryTime);
+                if (v != nullptr) placeVehicle((int)spot, v);
+            } else {
+                displaced.push_back(spot);
+            }
+        }
+
+        // The lot was made smaller since the snapshot: move vehicles into free spots.
+        for (uint64_t spot : displaced) {
+            const SnapshotRecord& rec = snapshot.record(spot);
+            int target = takeFreeSpot();
+            if (target < 0) { // More records than the header's occupied count
+                overCapacity = true;
+                break;
+            }
+            string plate(rec.plate, strnlen(rec.plate, sizeof(rec.plate)));
+            Vehicle* v = createVehicle(rec.kind, plate, rec.entryTime);
+            if (v != nullptr) placeVehicle(target, v);
+        }
+
+        // The file now matches the lot, so later checkpoints only write changes.
+        snapshotFile.attach(snapshot, path, capacity);
+        fill(dirtyPages.begin(), dirtyPages.end(), 0);
+        return true;
+    }
+
+    // Reads "TYPE LICENSE_PLATE ENTRY_TIMESTAMP" lines into free spots.
+    // A legacy snapshot may start with "# LSN <n> REVENUE <x>", which is applied
+    // only when 'isSnapshot' is set. Returns the number of vehicles added, -1 if
+    // the file cannot be opened.
+    int readTextFile(const string& path, bool isSnapshot) {
+        MappedFile file;
+        if (!file.open(path, true)) return -1;
+
+        const char* begin = file.data();
+        const char* end = begin + file.size();
+
+        if (isSnapshot && begin != end && *begin == '#') {
+            const char* lineEnd = static_cast<const char*>(memchr(begin, '\n', end - begin));
+            parseSnapshotHeader(string_view(begin, (lineEnd ? lineEnd : end) - begin), snapshotLsn, totalRevenue);
+        }
+
+        // Sized to the file, so the small legacy files read at startup do not
+        // start (and join) a thread per core.
+        ThreadPool pool(textParseThreads(file.size()));
+
+        // 1. Parse line-aligned chunks in parallel into per-chunk record buffers.
+        vector<vector<SnapshotRecord>> chunks;
+        size_t skipped = parseVehicleTextParallel(pool, begin, end, chunks);
+        if (skipped > 0) cout << "Warning: Skipped " << skipped << " malformed lines in " << path << "." << endl;
+
+        size_t total = 0;
+        for (const vector<SnapshotRecord>& chunk : chunks) total += chunk.size();
+        plateIndex.reserve(occupiedCount + total);
+
+        // 2. Group each chunk's records by plate index shard.
+        size_t chunkCount = chunks.size();
+        vector<vector<vector<uint32_t>>> byShard(chunkCount, vector<vector<uint32_t>>(PlateIndex::SHARDS));
+        pool.parallelFor(chunkCount, [&](size_t c) {
+            for (size_t i = 0; i < chunks[c].size(); i++) {
+                const SnapshotRecord& rec = chunks[c][i];
+                byShard[c][PlateIndex::shardOf(string_view(rec.plate, strnlen(rec.plate, 16)))].push_back(i);
+            }
+        });
+
+        // 3. One thread per shard walks the chunks in file order, so the first
+        //    occurrence of a plate always wins, exactly as a sequential load.
+        //    Winners are indexed right away; 'slot' remembers where their spot
+        //    goes (map nodes never move), duplicates keep nullptr.
+        vector<vector<int*>> slot(chunkCount);
+        for (size_t c = 0; c < chunkCount; c++) slot[c].assign(chunks[c].size(), nullptr);
+        pool.parallelFor(PlateIndex::SHARDS, [&](size_t s) {
+            unordered_map<string, int>& map = plateIndex.shard(s);
+            for (size_t c = 0; c < chunkCount; c++) {
+                for (uint32_t i : byShard[c][s]) {
+                    const SnapshotRecord& rec = chunks[c][i];
+                    auto result = map.emplace(string(rec.plate, strnlen(rec.plate, 16)), -1);
+                    if (result.second) slot[c][i] = &result.first->second;
+                }
+            }
+        });
+
+        // 4. Winners take the free spots in file order (lowest spot first).
+        vector<int> freeList;
+        for (int spot = 0; spot < capacity; spot++) {
+            if (parkedVehicles[spot] == nullptr) freeList.push_back(spot);
+        }
+        vector<size_t> firstFree(chunkCount + 1, 0);
+        for (size_t c = 0; c < chunkCount; c++) {
+            size_t winners = 0;
+            for (int* s : slot[c]) winners += (s != nullptr);
+            firstFree[c + 1] = firstFree[c] + winners;
+        }
+
+        // 5. Create the vehicles in parallel; every chunk owns distinct spots.
+        pool.parallelFor(chunkCount, [&](size_t c) {
+            size_t next = firstFree[c];
+            for (size_t i = 0; i < chunks[c].size(); i++) {
+                if (slot[c][i] == nullptr) continue;
+                if (next < freeList.size()) {
+                    const SnapshotRecord& rec = chunks[c][i];
+                    int spot = freeList[next];
+                    parkedVehicles[spot] = createVehicle(rec.kind, string(rec.plate, strnlen(rec.plate, 16)), rec.entryTime);
+                    *slot[c][i] = spot;
+                }
+                next++;
+            }
+        });
+
+        // Winners that found no free spot are taken back out of the index.
+        size_t added = min(firstFree[chunkCount], freeList.size());
+        if (added < firstFree[chunkCount]) {
+            // An import may fill the lot up; saved data must fit completely.
+            if (isSnapshot) overCapacity = true;
+            else cout << "Warning: Imported data exceeds capacity, extra vehicles ignored." << endl;
+            for (size_t c = 0; c < chunkCount; c++) {
+                for (size_t i = 0; i < chunks[c].size(); i++) {
+                    if (slot[c][i] != nullptr && *slot[c][i] < 0) {
+                        const SnapshotRecord& rec = chunks[c][i];
+                        plateIndex.erase(string(rec.plate, strnlen(rec.plate, 16)));
+                    }
+                }
+            }
+        }
+        occupiedCount += added;
+        for (size_t i = 0; i < added; i++) markDirty(freeList[i]);
+        return (int)added;
+    }
+
+    // FILE I/O OPERATIONS
+    
+    // Makes every change so far durable. With a journal this only flushes it,
+    // which keeps shutdown fast (the next startup replays the journal tail).
+    // Without a journal the full snapshot is written.
+    void saveData() {
+        if (overCapacity) return;
+        bool saved;
+        if (journal.isOpen()) {
+            lock_guard<mutex> serial(checkpointMutex);
+            saved = writeHistory() && journal.sync();
+        } else {
+            saved = checkpoint();
+        }
+        if (!saved) {
+            cout << "Error: Could not open file for saving." << endl;
+            return;
+        }
+        cout << "Data saved successfully." << endl;
+    }
+
+    // Exports the current vehicles in the text format (no snapshot header).
+    bool exportText(const string& path) {
+        lock_guard<mutex> lock(lotMutex);
+        ofstream outFile(path);
+        if (!outFile.is_open()) return false;
+
+        // Format: TYPE LICENSE_PLATE ENTRY_TIMESTAMP
+        forEachVehicle([&outFile](Vehicle* v) {
+            outFile << v->getType() << " " << v->getLicensePlate() << " " << v->getEntryTime() << '\n';
+        });
+        outFile.close();
+        return !outFile.fail();
+    }
+
+    // Copies the spot table out one block of spots at a time and hands each
+    // copy to 'f(firstSpot, records, count)' after releasing the lock, so
+    // gates keep running during long exports. Every record is consistent, but
+    // a vehicle that moves meanwhile may be seen twice or not at all. Stops
+    // early when 'f' returns false.
+    void scanSpotBlocks(const function<bool(int, const SnapshotRecord*, int)>& f) {
+        const int BLOCK = 4096;
+        vector<SnapshotRecord> block(BLOCK);
+        for (int first = 0; first < capacity; first += BLOCK) {
+            int count = min(BLOCK, capacity - first);
+            {
+                lock_guard<mutex> lock(lotMutex);
+                for (int i = 0; i < count; i++) fillRecord(first + i, block[i]);
+            }
+            if (!f(first, block.data(), count)) return;
+        }
+    }
+
+    // Returns one page of the parked vehicles matching 'query'. Spots are read
+    // block by block (see scanSpotBlocks()) and nothing is materialized:
+    //  - in spot order the scan stops as soon as the page is full;
+    //  - otherwise a bounded heap keeps only the best offset+limit candidates
+    //    (partial top-K), so memory and sorting depend on the page size and
+    //    not on the number of vehicles.
+    // Only the rows of the page are turned into StatusRows. The plate index is
+    // a hash, so a plate prefix filter is checked during the scan.
+    StatusPage queryStatus(const StatusQuery& query, time_t now = 0) {
+        if (now == 0) now = time(0);
+        StatusPage page = {{}, 0, false};
+        if (query.platePrefix.size() > MAX_PLATE_LENGTH) return page;
+        // Both clamped to the lot size, so offset + limit cannot wrap around:
+        // an offset past the last vehicle gives an empty page.
+        size_t offset = min(query.offset, (size_t)capacity);
+        size_t wanted = offset + min(query.limit, (size_t)capacity);
+
+        // Fees only depend on the type and the dwell time, so one probe vehicle
+        // per type prices every row without creating a Vehicle for it.
+        const time_t PROBE_ENTRY = 1;
+        Vehicle* probes[3];
+        for (int kind = KIND_CAR; kind <= KIND_MOTORBIKE; kind++) probes[kind] = createVehicle(kind, "", PROBE_ENTRY);
+        auto feeOf = [&](const SnapshotRecord& rec) {
+            if (tariff) return tariff->fee(rec.kind, rec.entryTime, now);
+            return probes[rec.kind]->calculateFee(PROBE_ENTRY + (now - rec.entryTime));
+        };
+
+        struct Candidate {
+            double key;       // Entry time or fee
+            int spot;
+            SnapshotRecord rec;
+        };
+        // True if 'a' is listed before 'b'. Ties keep spot order.
+        auto before = [&](const Candidate& a, const Candidate& b) {
+            if (query.sortBy == SORT_PLATE) {
+                int order = memcmp(a.rec.plate, b.rec.plate, sizeof(a.rec.plate)); // NUL padding sorts first
+                if (order != 0) return query.descending ? order > 0 : order < 0;
+            } else if (a.key != b.key) {
+                return query.descending ? a.key > b.key : a.key < b.key;
+            }
+            return a.spot < b.spot;
+        };
+
+        // Spot order: the page itself. Sorted: a heap whose top is the worst
+        // candidate kept.
+        vector<Candidate> kept;
+        scanSpotBlocks([&](int first, const SnapshotRecord* records, int count) {
+            for (int i = 0; i < count; i++) {
+                const SnapshotRecord& rec = records[i];
+                if (rec.kind > KIND_MOTORBIKE) continue;
+                if (query.kind != KIND_UNKNOWN && rec.kind != query.kind) continue;
+                if (memcmp(rec.plate, query.platePrefix.data(), query.platePrefix.size()) != 0) continue;
+                if (now - rec.entryTime < query.minDwellSeconds) continue;
+
+                page.matched++;
+                if (query.sortBy == SORT_SPOT) {
+                    if ((size_t)page.matched > wanted) {
+                        page.hasMore = true;
+                        return false;
+                    }
+                    if ((size_t)page.matched > offset) kept.push_back({0.0, first + i, rec});
+                    continue;
+                }
+
+                Candidate c = {0.0, first + i, rec};
+                if (query.sortBy == SORT_ENTRY_TIME) c.key = rec.entryTime;
+                else if (query.sortBy == SORT_FEE) c.key = feeOf(rec);
+                if (kept.size() < wanted) {
+                    kept.push_back(c);
+                    push_heap(kept.begin(), kept.end(), before);
+                } else if (wanted > 0 && before(c, kept.front())) {
+                    pop_heap(kept.begin(), kept.end(), before);
+                    kept.back() = c;
+                    push_heap(kept.begin(), kept.end(), before);
+                }
+            }
+            return true;
+        });
+
+        if (query.sortBy == SORT_SPOT) {
+            if (page.hasMore) page.matched = -1;
+        } else {
+            sort_heap(kept.begin(), kept.end(), before);
+            kept.erase(kept.begin(), kept.begin() + min(offset, kept.size()));
+            page.hasMore = (size_t)page.matched > wanted;
+        }
+
+        page.rows.reserve(kept.size());
+        for (const Candidate& c : kept) {
+            page.rows.push_back({c.spot, c.rec.kind, string(c.rec.plate, strnlen(c.rec.plate, sizeof(c.rec.plate))),
+                                 (time_t)c.rec.entryTime, feeOf(c.rec)});
+        }
+        for (Vehicle* probe : probes) delete probe;
+        return page;
+    }
+
+    // Streams the parked vehicles to 'path' as CSV or JSON (see
+    // scanSpotBlocks()). Returns the number of rows, -1 on error.
+    int64_t exportLive(const string& path, ExportFormat format) {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return -1;
+
+        OutputBuffer out(fd);
+        RowWriter writer(out, format, {"spot", "type", "plate", "entry_time", "parked_seconds"});
+        int64_t now = time(0);
+        scanSpotBlocks([&](int first, const SnapshotRecord* records, int count) {
+            for (int i = 0; i < count; i++) {
+                const SnapshotRecord& rec = records[i];
+                if (rec.kind == KIND_UNKNOWN) continue;
+                writer.integer(first + i);
+                writer.text(vehicleKindName(rec.kind));
+                writer.text(string_view(rec.plate, strnlen(rec.plate, sizeof(rec.plate))));
+                writer.timestamp(rec.entryTime);
+                writer.integer(now - rec.entryTime);
+                writer.endRow();
+            }
+            return out.ok();
+        });
+        bool ok = writer.finish() && fsync(fd) == 0;
+        ::close(fd);
+        return ok ? (int64_t)writer.rowCount() : -1;
+    }
+
+    // Writes the parked vehicles as an Arrow IPC file: one record batch per
+    // block of spots, type and plate as dictionary columns. Returns the
+    // number of rows, -1 on error.
+    int64_t exportLiveArrow(const string& path) {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return -1;
+
+        OutputBuffer out(fd);
+        ArrowFileWriter writer(out, {{"spot", ARROW_INT32, 0}, {"type", ARROW_DICT_INT8, 0},
+                                     {"plate", ARROW_DICT_INT32, 1}, {"entry_time", ARROW_TIMESTAMP, 0}});
+        vector<string> plates;
+        vector<int32_t> spots, plateIds;
+        vector<int8_t> kinds;
+        vector<int64_t> entryTimes;
+        scanSpotBlocks([&](int first, const SnapshotRecord* records, int count) {
+            spots.clear();
+            plateIds.clear();
+            kinds.clear();
+            entryTimes.clear();
+            for (int i = 0; i < count; i++) {
+                const SnapshotRecord& rec = records[i];
+                if (rec.kind == KIND_UNKNOWN) continue;
+                spots.push_back(first + i);
+                kinds.push_back(rec.kind);
+                plateIds.push_back(plates.size());
+                plates.emplace_back(rec.plate, strnlen(rec.plate, sizeof(rec.plate)));
+                entryTimes.push_back(rec.entryTime);
+            }
+            if (spots.empty()) return true;
+            writer.beginBatch(spots.size());
+            writer.addColumn(spots.data(), sizeof(int32_t));
+            writer.addColumn(kinds.data(), sizeof(int8_t));
+            writer.addColumn(plateIds.data(), sizeof(int32_t));
+            writer.addColumn(entryTimes.data(), sizeof(int64_t));
+            writer.endBatch();
+            return out.ok();
+        });
+        writer.writeDictionary(0, ARROW_TYPE_DICTIONARY);
+        writer.writeDictionary(1, plates);
+        bool ok = writer.finish() && fsync(fd) == 0;
+        ::close(fd);
+        return ok ? (int64_t)plates.size() : -1;
+    }
+
+    // Streams the session history (including sessions not yet archived) to
+    // 'path' as CSV or JSON, one archive block at a time. Returns the number
+    // of rows, -1 on error.
+    int64_t exportHistory(const string& path, ExportFormat format) {
+        {
+            lock_guard<mutex> serial(checkpointMutex);
+            if (!writeHistory()) return -1;
+        }
+
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return -1;
+
+        OutputBuffer out(fd);
+        RowWriter writer(out, format, {"type", "plate", "entry_time", "exit_time", "duration_seconds", "fee"});
+        HistoryReader reader;
+        if (reader.open(HISTORY_FILE)) {
+            HistoryColumns columns;
+            while (out.ok() && reader.next(columns)) {
+                const vector<string>& plates = reader.plates();
+                for (size_t i = 0; i < columns.size(); i++) {
+                    writer.text(vehicleKindName(columns.kinds[i]));
+                    writer.text(plates[columns.plateIds[i]]);
+                    writer.timestamp(columns.entryTimes[i]);
+                    writer.timestamp(columns.exitTimes[i]);
+                    writer.integer(columns.exitTimes[i] - columns.entryTimes[i]);
+                    writer.cents(columns.feeCents[i]);
+                    writer.endRow();
+                }
+            }
+        }
+        bool ok = writer.finish() && fsync(fd) == 0;
+        ::close(fd);
+        return ok ? (int64_t)writer.rowCount() : -1;
+    }
+
+    // Writes the session history as an Arrow IPC file, one record batch per
+    // archive block. The archive is already columnar, so every column is
+    // copied as is: type codes become int8 dictionary indices, plate ids
+    // int32 indices into the archive's plate dictionary. Returns the number of
+    // rows, -1 on error.
+    int64_t exportHistoryArrow(const string& path) {
+        {
+            lock_guard<mutex> serial(checkpointMutex);
+            if (!writeHistory()) return -1;
+        }
+
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return -1;
+
+        OutputBuffer out(fd);
+        ArrowFileWriter writer(out, {{"type", ARROW_DICT_INT8, 0}, {"plate", ARROW_DICT_INT32, 1},
+                                     {"entry_time", ARROW_TIMESTAMP, 0}, {"exit_time", ARROW_TIMESTAMP, 0},
+                                     {"fee_cents", ARROW_INT64, 0}});
+        HistoryReader reader;
+        int64_t rows = 0;
+        if (reader.open(HISTORY_FILE)) {
+            HistoryColumns columns;
+            while (out.ok() && reader.next(columns)) {
+                writer.beginBatch(columns.size());
+                writer.addColumn(columns.kinds.data(), sizeof(uint8_t));
+                writer.addColumn(columns.plateIds.data(), sizeof(uint32_t));
+                writer.addColumn(columns.entryTimes.data(), sizeof(int64_t));
+                writer.addColumn(columns.exitTimes.data(), sizeof(int64_t));
+                writer.addColumn(columns.feeCents.data(), sizeof(uint64_t));
+                writer.endBatch();
+                rows += columns.size();
+            }
+        }
+        writer.writeDictionary(0, ARROW_TYPE_DICTIONARY);
+        writer.writeDictionary(1, reader.plates());
+        bool ok = writer.finish() && fsync(fd) == 0;
+        ::close(fd);
+        return ok ? rows : -1;
+    }
+
+    // Adds the vehicles of a text file to the lot, then checkpoints so the
+    // import is durable without journaling every line. Returns -1 on error.
+    int importText(const string& path) {
+        int added;
+        {
+            lock_guard<mutex> lock(lotMutex);
+            materializeAll();
+            added = readTextFile(path, false);
+        }
+        if (added > 0 && !checkpoint()) return -1;
+        return added;
+    }
+
+    // Loads the last snapshot, then replays newer journal records on top of it.
+    // The binary snapshot is preferred; the text file is only read to migrate
+    // data saved by older versions.
+    void loadData() {
+        recoverSnapshotPages(SNAPSHOT_FILE);
+        bool loaded = loadBinarySnapshot(SNAPSHOT_FILE);
+        if (!loaded && readTextFile(DATA_FILE, true) >= 0) {
+            loaded = true;
+            checkpointRequested = true; // Migrate to the binary snapshot soon
+        }
+        if (overCapacity) {
+            reportOverCapacity();
+            return;
+        }
+
+        if (!history.open(HISTORY_FILE)) {
+            cout << "Warning: Could not open history archive, completed sessions are not kept." << endl;
+        }
+
+        if (!journal.open(JOURNAL_FILE, storageOptions.journal)) {
+            cout << "Warning: Could not open journal, changes are only saved on exit." << endl;
+        } else {
+            // A leftover rotated segment means the last checkpoint did not finish.
+            auto apply = [this](const JournalRecord& rec) { applyJournalRecord(rec); };
+            int replayed = journal.replaySegment(JOURNAL_OLD_FILE, snapshotLsn, apply);
+            oldSegmentLsn = journal.lastLsn(); // At least the segment's last record
+            replayed += journal.replay(max(snapshotLsn, journal.lastLsn()), apply);
+            // Fold the replayed tail into a snapshot right away, so replay at the
+            // next start stays within one checkpoint interval.
+            eventsSinceCheckpoint = replayed;
+            checkpointRequested = checkpointRequested || replayed > 0;
+            if (replayed > 0) cout << "Recovered " << replayed << " journaled events." << endl;
+        }
+        if (overCapacity) {
+            reportOverCapacity();
+            return;
+        }
+
+        if (loaded) cout << "Previous data loaded." << endl;
+    }
+
+    void reportOverCapacity() const {
+        cout << "Error: The saved vehicles do not fit into " << capacity << " spots. "
+             << "Start with a larger --capacity; the data files were left unchanged." << endl;
+    }
+};
+
+// BENCHMARK: TEXT LOADER
+// Generates 'lines' synthetic vehicles into a temporary file, then times the
+// mmap + from_chars parser (single-threaded and chunked across all cores)
+// against the old "inFile >> type >> plate >> time" loop on the same file.
+// Only parsing is measured, not Vehicle allocation.
+int runTextLoadBenchmark(size_t lines) {
+    char path[] = "/tmp/parking_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        cout << "Error: Could not create benchmark file." << endl;
+        return 1;
+    }
+    ::close(fd);
+
+    {
+        const char* types[] = {"Car", "Truck", "Motorbike"};
+        ofstream out(path);
+        for (size_t i = 0; i < lines; i++) {
+            out << types[i % 3] << " " << (10 + i % 80) << "BM" << (1000000 + i) << " " << (1766000000 + (int64_t)i) << '\n';
+        }
+    }
+
+    typedef chrono::steady_clock Clock;
+    vector<SnapshotRecord> records;
+    records.reserve(lines);
+    double bestSeconds = 1e30;
+    size_t bytes = 0;
+
+    for (int run = 0; run < 5; run++) {
+        records.clear();
+        Clock::time_point start = Clock::now();
+        MappedFile file;
+        file.open(path, true);
+        parseVehicleText(file.data(), file.data() + file.size(), records);
+        double seconds = chrono::duration<double>(Clock::now() - start).count();
+        bestSeconds = min(bestSeconds, seconds);
+        bytes = file.size();
+    }
+
+    // Same file split into line-aligned chunks across all cores.
+    ThreadPool pool(thread::hardware_concurrency());
+    double bestParallelSeconds = 1e30;
+    for (int run = 0; run < 5; run++) {
+        vector<vector<SnapshotRecord>> chunks;
+        Clock::time_point start = Clock::now();
+        MappedFile file;
+        file.open(path, true);
+        parseVehicleTextParallel(pool, file.data(), file.data() + file.size(), chunks);
+        double seconds = chrono::duration<double>(Clock::now() - start).count();
+        bestParallelSeconds = min(bestParallelSeconds, seconds);
+    }
+
+    size_t streamCount = 0;
+    Clock::time_point start = Clock::now();
+    {
+        ifstream inFile(path);
+        string type, plate;
+        time_t timeEntry;
+        while (inFile >> type >> plate >> timeEntry) streamCount++;
+    }
+    double streamSeconds = chrono::duration<double>(Clock::now() - start).count();
+    unlink(path);
+
+    double megabytes = bytes / 1e6;
+    cout << fixed << setprecision(1);
+    cout << "Parsed " << records.size() << " lines (" << megabytes << " MB)" << endl;
+    cout << "from_chars loader: " << bestSeconds * 1000 << " ms, " << megabytes / bestSeconds << " MB/s, "
+         << records.size() / bestSeconds / 1e6 << " M lines/s" << endl;
+    cout << "parallel loader (" << pool.size() << " threads): " << bestParallelSeconds * 1000 << " ms, "
+         << megabytes / bestParallelSeconds << " MB/s" << endl;
+    cout << "istream loop:      " << streamSeconds * 1000 << " ms, " << megabytes / streamSeconds << " MB/s ("
+         << streamCount << " lines)" << endl;
+    cout << "Speedup: " << streamSeconds / bestSeconds << "x" << defaultfloat << endl;
+    return 0;
+}
+
+// REPORT: SESSION HISTORY
+// Scans the whole archive and prints totals per vehicle type. Sessions still
+// buffered by a running program are not included until its next checkpoint.
+int runHistoryReport(const string& path) {
+    typedef chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+
+    HistoryReader reader;
+    if (!reader.open(path)) {
+        cout << "Error: Could not open " << path << "." << endl;
+        return 1;
+    }
+
+    uint64_t sessions[3] = {0, 0, 0};
+    uint64_t feeCents[3] = {0, 0, 0};
+    int64_t dwellSeconds[3] = {0, 0, 0};
+    int64_t firstExit = 0, lastExit = 0;
+    uint64_t total = 0;
+
+    HistoryColumns columns;
+    while (reader.next(columns)) {
+        for (size_t i = 0; i < columns.size(); i++) {
+            uint8_t kind = columns.kinds[i];
+            if (kind > KIND_MOTORBIKE) continue;
+            sessions[kind]++;
+            feeCents[kind] += columns.feeCents[i];
+            dwellSeconds[kind] += columns.exitTimes[i] - columns.entryTimes[i];
+        }
+        if (total == 0) firstExit = columns.exitTimes.front();
+        lastExit = columns.exitTimes.back();
+        total += columns.size();
+    }
+    double seconds = chrono::duration<double>(Clock::now() - start).count();
+
+    cout << "=== SESSION HISTORY (" << total << " sessions, " << reader.plates().size() << " distinct plates) ===" << endl;
+    if (total > 0) {
+        time_t from = firstExit, to = lastExit;
+        cout << "First exit: " << ctime(&from);
+        cout << "Last exit:  " << ctime(&to);
+    }
+    cout << fixed << setprecision(2);
+    for (int kind = KIND_CAR; kind <= KIND_MOTORBIKE; kind++) {
+        if (sessions[kind] == 0) continue;
+        cout << setw(10) << left << vehicleKindName(kind) << right
+             << setw(10) << sessions[kind] << " sessions  revenue $" << feeCents[kind] / 100.0
+             << "  avg stay " << dwellSeconds[kind] / 60.0 / sessions[kind] << " min" << endl;
+    }
+    cout << "Scanned " << reader.position() << " bytes in " << seconds * 1000 << " ms";
+    if (seconds > 0) cout << " (" << total / seconds / 1e6 << " M sessions/s)";
+    cout << defaultfloat << endl;
+    return 0;
+}
+
+// SELF-CHECK: CRASH RECOVERY
+// Exercises the recovery paths that normal runs never take, in a scratch
+// directory (the data file names are relative): a journal whose last record
+// was torn by a crash, a snapshot written by a checkpoint and loaded again
+// (eagerly and lazily), and an incremental checkpoint interrupted while its
+// pages were being copied into the snapshot (plus a torn page log, which
+// must be ignored). Crashes are real: a forked child works on the lot and
+// leaves with _exit(), so no destructor saves anything. The lots' own
+// messages are captured and only shown for a failed check.
+const time_t CHECK_ENTRY = 1767225600;
+
+// Removes every file a persistent lot creates in the current directory.
+void removeDataFiles() {
+    const char* files[] = {DATA_FILE, SNAPSHOT_FILE, JOURNAL_FILE, JOURNAL_OLD_FILE, HISTORY_FILE};
+    for (const char* file : files) unlink(file);
+    unlink((string(SNAPSHOT_FILE) + ".pages").c_str());
+    unlink((string(SNAPSHOT_FILE) + ".tmp").c_str());
+}
+
+// Journal records are only needed until their checkpoint; dropping the
+// files leaves the snapshot as the only source of the lot's contents.
+void removeJournalFiles() {
+    unlink(JOURNAL_FILE);
+    unlink(JOURNAL_OLD_FILE);
+}
+
+string checkPlate(int i) { return "CHK" + to_string(i); }
+
+// Parks vehicles first .. last - 1 with entry times a minute apart.
+void parkCheckVehicles(ParkingLot& lot, int first, int last) {
+    for (int i = first; i < last; i++) {
+        lot.park(createVehicle(i % 3, checkPlate(i), CHECK_ENTRY + i * 60));
+    }
+}
+
+// True if exactly the plates of 'present' are parked (none of 'absent' is).
+bool lotHolds(ParkingLot& lot, const vector<int>& present, const vector<int>& absent) {
+    for (int i : present) {
+        if (!lot.quote(checkPlate(i), CHECK_ENTRY + 86400).found) return false;
+    }
+    for (int i : absent) {
+        if (lot.quote(checkPlate(i), CHECK_ENTRY + 86400).found) return false;
+    }
+    return lot.summary().occupied == (int)present.size();
+}
+
+bool readWholeFile(const string& path, vector<char>& bytes) {
+    MappedFile file;
+    if (!file.open(path)) return false;
+    bytes.assign(file.data(), file.data() + file.size());
+    return true;
+}
+
+bool writeWholeFile(const string& path, const char* data, size_t size) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    bool ok = writeAll(fd, data, size);
+    return ::close(fd) == 0 && ok;
+}
+
+// Runs 'work' in a child process that ends without any cleanup, like a crash.
+bool runAndCrash(const function<void()>& work) {
+    cout.flush();
+    pid_t child = fork();
+    if (child < 0) return false;
+    if (child == 0) {
+        work();
+        _exit(0);
+    }
+    int status;
+    return waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Three parks reach the journal, then the process dies and the last record
+// loses its second half. Startup must keep the first two and drop the tail.
+bool checkTornJournalTail(string& detail) {
+    removeDataFiles();
+    bool crashed = runAndCrash([] {
+        StorageOptions options;
+        options.journal.durability = DURABILITY_STRICT; // Every park is on disk before it returns
+        ParkingLot lot(10, options);
+        parkCheckVehicles(lot, 0, 3);
+    });
+    struct stat st;
+    if (!crashed || stat(JOURNAL_FILE, &st) != 0 || st.st_size != 3 * (off_t)sizeof(JournalRecord)) {
+        detail = "the crashed run did not leave three journal records";
+        return false;
+    }
+    if (truncate(JOURNAL_FILE, st.st_size - sizeof(JournalRecord) / 2) != 0) {
+        detail = "could not truncate the journal";
+        return false;
+    }
+    ParkingLot lot(10);
+    if (!lotHolds(lot, {0, 1}, {2})) {
+        detail = "expected the first two parks to survive and the torn one to be dropped";
+        return false;
+    }
+    return true;
+}
+
+// A checkpoint writes the snapshot; without any journal left, a restart must
+// show the same vehicles in the same spots with the same fees and revenue.
+bool checkSnapshotRoundTrip(bool lazyLoad, string& detail) {
+    removeDataFiles();
+    vector<UnparkResult> before;
+    double revenue;
+    {
+        ParkingLot lot(300);
+        parkCheckVehicles(lot, 0, 200);
+        for (int i = 0; i < 200; i += 7) lot.unpark(checkPlate(i), CHECK_ENTRY + 3 * 3600);
+        if (!lot.checkpointNow()) {
+            detail = "checkpoint failed";
+            return false;
+        }
+        for (int i = 0; i < 200; i++) before.push_back(lot.quote(checkPlate(i), CHECK_ENTRY + 86400));
+        revenue = lot.summary().revenue;
+    }
+    removeJournalFiles();
+
+    StorageOptions options;
+    options.lazyLoad = lazyLoad;
+    ParkingLot lot(300, options);
+    for (int i = 0; i < 200; i++) {
+        UnparkResult after = lot.quote(checkPlate(i), CHECK_ENTRY + 86400);
+        if (after.found != before[i].found || after.spot != before[i].spot || after.kind != before[i].kind
+            || after.fee != before[i].fee) {
+            detail = "vehicle " + checkPlate(i) + " differs after the restart";
+            return false;
+        }
+    }
+    if (lot.summary().revenue != revenue) {
+        detail = "revenue differs after the restart";
+        return false;
+    }
+    return true;
+}
+
+// Takes two checkpoints, S0 and S1, then puts the snapshot back into the
+// state of a crash during S1's in-place copy: S0 with part of S1's changed
+// pages, the header page (copied last) still S0's, and the page log of S1
+// next to it. Startup must finish the copy. With a torn page log instead,
+// the log must be discarded and S0 loaded as it is.
+bool checkInterruptedCheckpoint(bool tornLog, string& detail) {
+    removeDataFiles();
+    vector<char> first, second;
+    {
+        ParkingLot lot(1000);
+        parkCheckVehicles(lot, 0, 400);
+        bool ok = lot.checkpointNow() && readWholeFile(SNAPSHOT_FILE, first);
+        for (int i = 0; i < 400; i += 3) lot.unpark(checkPlate(i), CHECK_ENTRY + 7200);
+        parkCheckVehicles(lot, 400, 700);
+        if (!ok || !lot.checkpointNow() || !readWholeFile(SNAPSHOT_FILE, second) || first.size() != second.size()) {
+            detail = "could not take the two checkpoints";
+            return false;
+        }
+    }
+
+    // The page log of S1: every page that differs from S0, header page last.
+    vector<uint64_t> pages;
+    for (uint64_t offset = SNAPSHOT_PAGE_SIZE; offset < first.size(); offset += SNAPSHOT_PAGE_SIZE) {
+        uint64_t length = min<uint64_t>(SNAPSHOT_PAGE_SIZE, first.size() - offset);
+        if (memcmp(&first[offset], &second[offset], length) != 0) pages.push_back(offset);
+    }
+    pages.push_back(0);
+    vector<char> log(sizeof(PageLogHeader));
+    for (uint64_t offset : pages) {
+        PageLogEntry entry = {offset, min<uint64_t>(SNAPSHOT_PAGE_SIZE, first.size() - offset)};
+        log.insert(log.end(), (const char*)&entry, (const char*)&entry + sizeof(entry));
+        log.insert(log.end(), &second[offset], &second[offset] + entry.length);
+    }
+    PageLogHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "PARKPLOG", 8);
+    header.baseLsn = reinterpret_cast<const SnapshotHeader*>(first.data())->lsn;
+    header.lsn = reinterpret_cast<const SnapshotHeader*>(second.data())->lsn;
+    header.pageCount = pages.size();
+    header.totalBytes = log.size();
+    header.checksum = fnv1a(log.data() + sizeof(PageLogHeader), log.size() - sizeof(PageLogHeader),
+                            fnv1a(&header, offsetof(PageLogHeader, checksum)));
+    memcpy(log.data(), &header, sizeof(header));
+    if (tornLog) log.resize(log.size() - 100);
+
+    // Half of the data pages made it into the snapshot before the crash. A
+    // torn log was never synced, so the copy cannot have started.
+    vector<char> torn = first;
+    for (size_t i = 0; !tornLog && i < (pages.size() - 1) / 2; i++) {
+        memcpy(&torn[pages[i]], &second[pages[i]], min<uint64_t>(SNAPSHOT_PAGE_SIZE, first.size() - pages[i]));
+    }
+    string logPath = string(SNAPSHOT_FILE) + ".pages";
+    removeJournalFiles();
+    if (pages.size() < 3 || !writeWholeFile(SNAPSHOT_FILE, torn.data(), torn.size())
+        || !writeWholeFile(logPath, log.data(), log.size())) {
+        detail = "could not set up the interrupted checkpoint";
+        return false;
+    }
+
+    vector<int> present, absent;
+    for (int i = 0; i < 700; i++) {
+        bool parked = tornLog ? i < 400 : (i >= 400 || i % 3 != 0);
+        (parked ? present : absent).push_back(i);
+    }
+    ParkingLot lot(1000);
+    if (access(logPath.c_str(), F_OK) == 0) {
+        detail = "the page log was not removed";
+        return false;
+    }
+    if (!lotHolds(lot, present, absent)) {
+        detail = tornLog ? "the torn page log was applied" : "the snapshot does not match the completed checkpoint";
+        return false;
+    }
+    return true;
+}
+
+// BATCH COMMAND MODE
+// Runs gate commands from a file or stdin without the menu, one per line:
+//   P <CAR|TRUCK|MOTORBIKE> <PLATE>   park   -> "OK P <plate> <spot>" or "ERR FULL|DUPLICATE|PLATE_TOO_LONG <plate>"
+//   U <PLATE>                         unpark -> "OK U <plate> <type> <fee>" or "ERR NOT_FOUND <plate>"
+//   S                                 status -> "OK S <occupied> <capacity> <revenue>"
+//   Q [options]                       query  -> "OK Q <rows> <matched> more|end", then
+//                                               "<spot> <type> <plate> <entry> <fee>" per row
+//                                               (options: see parseStatusQuery())
+// Malformed lines answer "ERR SYNTAX <line>"; blank lines and '#' comments are skipped.
+// Input is sliced into string_views inside one read buffer and every answer
+// goes through one OutputBuffer, so a command costs no allocation besides the
+// Vehicle itself.
+enum CommandOutcome { COMMAND_OK, COMMAND_SKIPPED, COMMAND_INVALID };
+
+// Vehicle type in any letter case ("CAR", "car", "Car").
+inline VehicleKind parseCommandKind(string_view token) {
+    char name[16];
+    if (token.empty() || token.size() > sizeof(name)) return KIND_UNKNOWN;
+    for (size_t i = 0; i < token.size(); i++) {
+        char c = token[i];
+        if (i == 0 && c >= 'a' && c <= 'z') c -= 'a' - 'A';
+        if (i > 0 && c >= 'A' && c <= 'Z') c += 'a' - 'A';
+        name[i] = c;
+    }
+    return vehicleKindFromName(string_view(name, token.size()));
+}
+
+// Parses the options of a status query, all optional and in any order:
+//   type=car|truck|motorbike  prefix=PLATE  min-dwell=SECONDS
+//   sort=spot|entry|plate|fee  desc  offset=N  limit=N
+bool parseStatusQuery(string_view args, StatusQuery& query) {
+    query = StatusQuery();
+    for (string_view token = nextToken(args); !token.empty(); token = nextToken(args)) {
+        if (token == "desc") {
+            query.descending = true;
+            continue;
+        }
+        size_t equals = token.find('=');
+        if (equals == string_view::npos) return false;
+        string_view name = token.substr(0, equals), value = token.substr(equals + 1);
+
+        if (name == "type") {
+            query.kind = parseCommandKind(value);
+            if (query.kind == KIND_UNKNOWN) return false;
+        } else if (name == "prefix") {
+            query.platePrefix = string(value);
+        } else if (name == "sort") {
+            if (value == "spot") query.sortBy = SORT_SPOT;
+            else if (value == "entry") query.sortBy = SORT_ENTRY_TIME;
+            else if (value == "plate") query.sortBy = SORT_PLATE;
+            else if (value == "fee") query.sortBy = SORT_FEE;
+            else return false;
+        } else {
+            uint64_t number;
+            from_chars_result parsed = from_chars(value.data(), value.data() + value.size(), number);
+            if (parsed.ec != errc() || parsed.ptr != value.data() + value.size()) return false;
+            if (name == "min-dwell") query.minDwellSeconds = (int64_t)min<uint64_t>(number, INT64_MAX);
+            else if (name == "offset") query.offset = number;
+            else if (name == "limit") query.limit = number;
+            else return false;
+        }
+    }
+    return true;
+}
+
+// One parsed command line. 'plate' points into the input buffer.
+struct GateCommand {
+    char op;            // 'P', 'U', 'S' or 'Q'
+    VehicleKind kind;   // Only for 'P'
+    string_view plate;  // Empty for 'S' and 'Q'
+    StatusQuery query;  // Only for 'Q'
+};
+
+CommandOutcome parseCommand(string_view line, GateCommand& cmd) {
+    string_view op = nextToken(line);
+    if (op.empty() || op[0] == '#') return COMMAND_SKIPPED;
+    if (op.size() != 1) return COMMAND_INVALID;
+
+    cmd.op = (op[0] >= 'a' && op[0] <= 'z') ? op[0] - ('a' - 'A') : op[0];
+    cmd.kind = KIND_UNKNOWN;
+    cmd.plate = string_view();
+    if (cmd.op == 'P') {
+        cmd.kind = parseCommandKind(nextToken(line));
+        if (cmd.kind == KIND_UNKNOWN) return COMMAND_INVALID;
+    }
+    if (cmd.op == 'Q') {
+        return parseStatusQuery(line, cmd.query) ? COMMAND_OK : COMMAND_INVALID;
+    } else if (cmd.op == 'P' || cmd.op == 'U') {
+        cmd.plate = nextToken(line);
+        if (cmd.plate.empty()) return COMMAND_INVALID;
+    } else if (cmd.op != 'S') {
+        return COMMAND_INVALID;
+    }
+    return nextToken(line).empty() ? COMMAND_OK : COMMAND_INVALID;
+}
+
+// Start of the answer to a park, followed by the plate.
+inline const char* parkAnswer(ParkStatus status) {
+    switch (status) {
+        case PARK_OK:             return "OK P ";
+        case PARK_FULL:           return "ERR FULL ";
+        case PARK_DUPLICATE:      return "ERR DUPLICATE ";
+        case PARK_PLATE_TOO_LONG: return "ERR PLATE_TOO_LONG ";
+    }
+    return "ERR ";
+}
+
+// With 'deferredLsn', parks and unparks do not wait for STRICT durability:
+// the highest journal sequence number is stored there instead and the caller
+// must wait for it before sending the answers.
+CommandOutcome runCommand(ParkingLot& lot, string_view line, OutputBuffer& out, uint64_t* deferredLsn = nullptr) {
+    GateCommand cmd;
+    CommandOutcome outcome = parseCommand(line, cmd);
+    if (outcome != COMMAND_OK) return outcome;
+
+    bool waitForDisk = deferredLsn == nullptr;
+    if (cmd.op == 'P') {
+        ParkResult result = lot.park(createVehicle(cmd.kind, string(cmd.plate), time(0)), waitForDisk);
+        if (!waitForDisk) *deferredLsn = max(*deferredLsn, result.lsn);
+        out.append(parkAnswer(result.status));
+        out.append(cmd.plate);
+        if (result.status == PARK_OK) {
+            out.append(' ');
+            out.appendUint(result.spot);
+        }
+    } else if (cmd.op == 'U') {
+        UnparkResult result = lot.unpark(string(cmd.plate), 0, waitForDisk);
+        if (!waitForDisk) *deferredLsn = max(*deferredLsn, result.lsn);
+        out.append(result.found ? "OK U " : "ERR NOT_FOUND ");
+        out.append(cmd.plate);
+        if (result.found) {
+            out.append(' ');
+            out.append(vehicleKindName(result.kind));
+            out.append(' ');
+            out.appendCents(llround(result.fee * 100));
+        }
+    } else if (cmd.op == 'Q') {
+        // Header with the row count, then one line per row
+        StatusPage page = lot.queryStatus(cmd.query);
+        out.append("OK Q ");
+        out.appendUint(page.rows.size());
+        out.append(' ');
+        out.appendInt(page.matched);
+        out.append(page.hasMore ? " more" : " end");
+        for (const StatusRow& row : page.rows) {
+            out.append('\n');
+            out.appendUint(row.spot);
+            out.append(' ');
+            out.append(vehicleKindName(row.kind));
+            out.append(' ');
+            out.append(row.plate);
+            out.append(' ');
+            out.appendTimestamp(row.entryTime);
+            out.append(' ');
+            out.appendCents(llround(row.fee * 100));
+        }
+    } else {
+        LotSummary summary = lot.summary();
+        out.append("OK S ");
+        out.appendUint(summary.occupied);
+        out.append(' ');
+        out.appendUint(summary.capacity);
+        out.append(' ');
+        out.appendCents(llround(summary.revenue * 100));
+    }
+    out.append('\n');
+    return COMMAND_OK;
+}
+
+struct CommandCounters {
+    uint64_t lines = 0;
+    uint64_t commands = 0;
+    uint64_t invalid = 0;
+};
+
+// Runs every complete line in 'data' and answers into 'out'. Returns the
+// number of bytes used; an unfinished last line is left for the caller to
+// complete unless 'atEnd'.
+size_t runCommandLines(ParkingLot& lot, const char* data, size_t size, bool atEnd,
+                       OutputBuffer& out, CommandCounters& counters, uint64_t* deferredLsn = nullptr) {
+    const char* p = data;
+    const char* end = data + size;
+    while (p < end) {
+        const char* newline = (const char*)memchr(p, '\n', end - p);
+        if (newline == nullptr) {
+            if (!atEnd) break; // Finish this line after the next read
+            newline = end;
+        }
+        counters.lines++;
+        CommandOutcome outcome = runCommand(lot, string_view(p, newline - p), out, deferredLsn);
+        if (outcome == COMMAND_OK) {
+            counters.commands++;
+        } else if (outcome == COMMAND_INVALID) {
+            counters.invalid++;
+            out.append("ERR SYNTAX ");
+            out.appendUint(counters.lines);
+            out.append('\n');
+        }
+        p = newline + 1;
+    }
+    return min(p, end) - data;
+}
+
+// Reads commands from 'path' ("" or "-" for stdin) until end of input.
+// Answers go to stdout, the throughput report to stderr.
+int runBatch(ParkingLot& lot, const string& path) {
+    bool useStdin = path.empty() || path == "-";
+    int fd = useStdin ? STDIN_FILENO : open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cout << "Error: Could not open " << path << "." << endl;
+        return 1;
+    }
+    cout << flush; // Keep earlier console output ahead of the raw writes
+
+    typedef chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+
+    OutputBuffer out(STDOUT_FILENO);
+    vector<char> input(1 << 20);
+    size_t kept = 0;        // Bytes of an unfinished line carried over from the last read
+    CommandCounters counters;
+    bool readFailed = false;
+
+    while (true) {
+        if (kept == input.size()) input.resize(input.size() * 2); // A single very long line
+        ssize_t n = read(fd, input.data() + kept, input.size() - kept);
+        if (n < 0) {
+            readFailed = true;
+            break;
+        }
+        bool atEnd = (n == 0);
+        size_t available = kept + n;
+        size_t used = runCommandLines(lot, input.data(), available, atEnd, out, counters);
+        kept = available - used;
+        memmove(input.data(), input.data() + used, kept);
+        if (atEnd) break;
+    }
+    if (!useStdin) close(fd);
+    bool written = out.flush();
+    double seconds = chrono::duration<double>(Clock::now() - start).count();
+
+    cerr << fixed << setprecision(1) << "Batch: " << counters.commands << " commands";
+    if (counters.invalid > 0) cerr << ", " << counters.invalid << " malformed lines";
+    cerr << " in " << seconds * 1000 << " ms";
+    if (seconds > 0) cerr << " (" << setprecision(0) << counters.commands / seconds << " cmds/s)";
+    cerr << defaultfloat << endl;
+
+    if (readFailed) cout << "Error: Could not read " << (useStdin ? "stdin" : path) << "." << endl;
+    if (!written) cout << "Error: Could not write the batch output." << endl;
+    return (readFailed || !written) ? 1 : 0;
+}
+
+// TRACE REPLAY
+// Replays recorded gate traffic as fast as possible on an empty in-memory lot.
+// A trace is a batch file with a Unix timestamp in front of every command:
+//   1760000000 P CAR ABC123
+//   1760003600 U ABC123
+// Parks use the recorded time as entry time and unparks as exit time, so the
+// fees and the final revenue are identical on every run and across builds.
+struct TraceEvent {
+    time_t time;
+    char op;
+    VehicleKind kind;
+    string plate;
+};
+
+// Loads the whole trace up front so that file I/O is not part of the timing.
+bool loadTrace(const string& path, vector<TraceEvent>& events, size_t& malformed) {
+    MappedFile file;
+    if (!file.open(path, true)) return false;
+
+    const char* p = file.data();
+    const char* end = p + file.size();
+    malformed = 0;
+    while (p < end) {
+        const char* newline = (const char*)memchr(p, '\n', end - p);
+        if (newline == nullptr) newline = end;
+        string_view line(p, newline - p);
+        p = newline + 1;
+
+        string_view stamp = nextToken(line);
+        if (stamp.empty() || stamp[0] == '#') continue;
+
+        int64_t time;
+        GateCommand cmd;
+        from_chars_result parsed = from_chars(stamp.data(), stamp.data() + stamp.size(), time);
+        if (parsed.ec != errc() || parsed.ptr != stamp.data() + stamp.size()
+            || parseCommand(line, cmd) != COMMAND_OK || cmd.op == 'Q') { // Queries are not gate traffic
+            malformed++;
+            continue;
+        }
+        events.push_back({(time_t)time, cmd.op, cmd.kind, string(cmd.plate)});
+    }
+    return true;
+}
+
+// Prints "Latency: p50 ... max ..." in microseconds (sorts 'nanos').
+void printLatencyPercentiles(vector<uint64_t>& nanos) {
+    if (nanos.empty()) return;
+    sort(nanos.begin(), nanos.end());
+    const double fractions[] = {0.5, 0.9, 0.99, 0.999};
+    const char* labels[] = {"p50", "p90", "p99", "p99.9"};
+    cout << fixed << setprecision(1) << "Latency:";
+    for (int i = 0; i < 4; i++) {
+        size_t rank = min(nanos.size() - 1, (size_t)(fractions[i] * nanos.size()));
+        cout << " " << labels[i] << " " << nanos[rank] / 1000.0 << " us,";
+    }
+    cout << " max " << nanos.back() / 1000.0 << " us" << defaultfloat << endl;
+}
+
+int runReplay(const string& path, int capacity) {
+    vector<TraceEvent> events;
+    size_t malformed;
+    if (!loadTrace(path, events, malformed)) {
+        cout << "Error: Could not open " << path << "." << endl;
+        return 1;
+    }
+    if (malformed > 0) cout << "Warning: Skipped " << malformed << " malformed trace lines." << endl;
+
+    StorageOptions options;
+    options.persistent = false; // Always start empty, never touch the data files
+    ParkingLot lot(capacity, options);
+
+    typedef chrono::steady_clock Clock;
+    vector<uint64_t> latencyNanos(events.size());
+    uint64_t parked = 0, unparked = 0, full = 0, duplicate = 0, badPlate = 0, notFound = 0;
+
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < events.size(); i++) {
+        const TraceEvent& e = events[i];
+        Clock::time_point opStart = Clock::now();
+        if (e.op == 'P') {
+            switch (lot.park(createVehicle(e.kind, e.plate, e.time)).status) {
+                case PARK_OK:             parked++; break;
+                case PARK_FULL:           full++; break;
+                case PARK_DUPLICATE:      duplicate++; break;
+                case PARK_PLATE_TOO_LONG: badPlate++; break;
+            }
+        } else if (e.op == 'U') {
+            if (lot.unpark(e.plate, e.time).found) unparked++;
+            else notFound++;
+        } else {
+            lot.summary();
+        }
+        latencyNanos[i] = chrono::duration_cast<chrono::nanoseconds>(Clock::now() - opStart).count();
+    }
+    double seconds = chrono::duration<double>(Clock::now() - start).count();
+    LotSummary summary = lot.summary();
+
+    cout << fixed << setprecision(1);
+    cout << "=== TRACE REPLAY (" << events.size() << " events, capacity " << capacity << ") ===" << endl;
+    cout << "Parked " << parked << ", unparked " << unparked << "; rejected: " << full << " full, "
+         << duplicate << " duplicate, " << badPlate << " bad plate, " << notFound << " not found" << endl;
+    cout << "Time: " << seconds * 1000 << " ms";
+    if (seconds > 0) cout << " (" << setprecision(0) << events.size() / seconds << " ops/s)" << setprecision(1);
+    cout << endl;
+    printLatencyPercentiles(latencyNanos);
+    cout << fixed << setprecision(2) << "Final revenue: $" << summary.revenue
+         << " (" << summary.occupied << "/" << summary.capacity << " occupied)" << defaultfloat << endl;
+    return 0;
+}
+
+// WORKLOAD GENERATOR
+// Synthetic gate traffic for the simulation and for trace files. Arrivals
+// are a non-homogeneous Poisson process: the mean rate times an hour-of-day
+// and a day-of-week weight (UTC), normalized so that a week averages to the
+// mean rate. The rate is constant within an hour, so the next arrival is
+// found exactly by spending one exponential draw across the hours ahead;
+// nothing is drawn and rejected as with thinning. Stays are exponential,
+// lognormal with the same mean, or resampled from the stays recorded in a
+// session history archive (empirical). Vehicle types follow fixed shares.
+enum ArrivalProfile { PROFILE_FLAT, PROFILE_DIURNAL };
+enum DwellModel { DWELL_EXPONENTIAL, DWELL_LOGNORMAL, DWELL_EMPIRICAL };
+
+struct WorkloadConfig {
+    double days = 365;
+    double arrivalsPerHour = 0;     // Weekly average; 0: 80% of what the lot can hold on average
+    ArrivalProfile profile = PROFILE_FLAT;
+    DwellModel dwell = DWELL_EXPONENTIAL;
+    double meanStayHours = 3;       // For DWELL_EMPIRICAL, the mean of the observed stays
+    double dwellSigma = 0.8;        // Spread of the lognormal (sigma of the log of the stay)
+    vector<double> observedStays;   // Seconds, for DWELL_EMPIRICAL
+    double truckShare = 0.10;       // The rest are cars
+    double motorbikeShare = 0.15;
+    uint64_t seed = 1;
+    time_t start = 1767225600;      // 2026-01-01 00:00 UTC
+};
+
+// Relative arrival rates of a garage near offices and shops: morning and
+// evening peaks on weekdays, quiet nights and Sundays. Index 0 is midnight
+// and Sunday respectively.
+const double DIURNAL_HOUR_WEIGHTS[24] = {0.10, 0.05, 0.05, 0.05, 0.10, 0.30, 0.80, 1.80, 2.40, 1.90, 1.40, 1.30,
+                                         1.50, 1.40, 1.20, 1.30, 1.60, 1.80, 1.40, 1.00, 0.70, 0.50, 0.30, 0.20};
+const double DIURNAL_DAY_WEIGHTS[7] = {0.50, 1.10, 1.10, 1.10, 1.10, 1.20, 0.80};
+
+inline const char* arrivalProfileName(ArrivalProfile profile) {
+    return profile == PROFILE_DIURNAL ? "diurnal" : "flat";
+}
+
+inline const char* dwellModelName(DwellModel dwell) {
+    const char* NAMES[] = {"exponential", "lognormal", "empirical"};
+    return NAMES[dwell];
+}
+
+// 80% of what 'capacity' spots can hold at the mean stay.
+inline void applyDefaultArrivalRate(WorkloadConfig& config, int capacity) {
+    if (config.arrivalsPerHour <= 0) config.arrivalsPerHour = 0.8 * capacity / config.meanStayHours;
+}
+
+// Collects every recorded stay (exit - entry, in seconds) of a history
+// archive as the sample of DWELL_EMPIRICAL. Returns false if there is none.
+bool loadObservedStays(const string& path, vector<double>& stays) {
+    HistoryReader reader;
+    if (!reader.open(path)) return false;
+    HistoryColumns columns;
+    while (reader.next(columns)) {
+        for (size_t i = 0; i < columns.size(); i++) {
+            stays.push_back((double)(columns.exitTimes[i] - columns.entryTimes[i]));
+        }
+    }
+    return !stays.empty();
+}
+
+// One generated vehicle: when it arrives (seconds since the start), what it
+// is, and how long it wants to stay.
+struct Arrival {
+    double time;
+    VehicleKind kind;
+    double stay;
+    uint64_t vehicle;   // Sequence number, encoded in its plate
+};
+
+class WorkloadGenerator {
+private:
+    const WorkloadConfig& config;
+    mt19937_64 random;
+    exponential_distribution<double> unitExponential;
+    uniform_real_distribution<double> unit;
+    exponential_distribution<double> exponentialStay;
+    lognormal_distribution<double> lognormalStay;
+    uniform_int_distribution<size_t> observedStay;
+    double weekRates[168];      // Arrivals per second by hour of the week, from Sunday 00:00 UTC
+    double now;
+    double horizon;
+    uint64_t nextVehicle;
+
+    double rateAt(int64_t wallHour) const { return weekRates[(wallHour + 96) % 168]; } // 1970-01-01 was a Thursday
+
+public:
+    // 'seed' picks the random stream; runs usually pass config.seed.
+    WorkloadGenerator(const WorkloadConfig& config, uint64_t seed)
+        : config(config), random(seed), unitExponential(1.0), unit(0.0, 1.0),
+          exponentialStay(1.0 / (config.meanStayHours * 3600)),
+          // A lognormal's mean is exp(mu + sigma^2 / 2): pick mu so that it is the configured mean.
+          lognormalStay(log(config.meanStayHours * 3600) - config.dwellSigma * config.dwellSigma / 2, config.dwellSigma),
+          observedStay(0, config.observedStays.empty() ? 0 : config.observedStays.size() - 1),
+          now(0), horizon(config.days * 86400), nextVehicle(0) {
+        double hourSum = 0, daySum = 0;
+        for (int hour = 0; hour < 24; hour++) hourSum += config.profile == PROFILE_DIURNAL ? DIURNAL_HOUR_WEIGHTS[hour] : 1;
+        for (int day = 0; day < 7; day++) daySum += config.profile == PROFILE_DIURNAL ? DIURNAL_DAY_WEIGHTS[day] : 1;
+        double scale = config.arrivalsPerHour / 3600 * 168 / (hourSum * daySum);
+        for (int i = 0; i < 168; i++) {
+            int day = i / 24, hour = i % 24;
+            weekRates[i] = config.profile == PROFILE_DIURNAL ? scale * DIURNAL_DAY_WEIGHTS[day] * DIURNAL_HOUR_WEIGHTS[hour] : scale;
+        }
+    }
+
+    // Writes "S" followed by the vehicle number in base 36 (unique, at most
+    // 13 characters) to 'out' and returns its length.
+    static size_t formatPlate(uint64_t vehicle, char* out) {
+        char digits[16];
+        char* p = digits + sizeof(digits);
+        do {
+            *--p = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"[vehicle % 36];
+            vehicle /= 36;
+        } while (vehicle > 0);
+        *--p = 'S';
+        size_t length = digits + sizeof(digits) - p;
+        memcpy(out, p, length);
+        return length;
+    }
+
+    static string plateOf(uint64_t vehicle) {
+        char plate[16];
+        return string(plate, formatPlate(vehicle, plate));
+    }
+
+    // The next arrival in time order. Returns false once the horizon is reached.
+    bool next(Arrival& arrival) {
+        double need = unitExponential(random);  // Expected arrivals to pass before the next one
+        while (true) {
+            if (now >= horizon) return false;
+            int64_t wallHour = (int64_t)floor((config.start + now) / 3600);
+            double hourEnd = (double)(wallHour + 1) * 3600 - config.start;
+            double rate = rateAt(wallHour);
+            double available = rate * (hourEnd - now);
+            if (available >= need) {
+                now += need / rate;
+                break;
+            }
+            need -= available;
+            now = hourEnd;
+        }
+        if (now >= horizon) return false;
+
+        arrival.time = now;
+        double u = unit(random);
+        arrival.kind = u < config.truckShare ? KIND_TRUCK
+                     : u < config.truckShare + config.motorbikeShare ? KIND_MOTORBIKE : KIND_CAR;
+        switch (config.dwell) {
+            case DWELL_EXPONENTIAL: arrival.stay = exponentialStay(random); break;
+            case DWELL_LOGNORMAL: arrival.stay = lognormalStay(random); break;
+            case DWELL_EMPIRICAL: arrival.stay = config.observedStays[observedStay(random)]; break;
+        }
+        arrival.vehicle = nextVehicle++;
+        return true;
+    }
+
+    double horizonSeconds() const { return horizon; }
+
+    // Highest hourly rate of the week, for reports.
+    double peakArrivalsPerHour() const { return *max_element(weekRates, weekRates + 168) * 3600; }
+};
+
+// Prints how the traffic is generated, under a report's title line.
+void printWorkload(const WorkloadConfig& config, const WorkloadGenerator& generator) {
+    cout << fixed << setprecision(1);
+    cout << "Workload: " << arrivalProfileName(config.profile) << " arrivals (peak " << generator.peakArrivalsPerHour()
+         << "/h), " << dwellModelName(config.dwell) << " stays";
+    if (config.dwell == DWELL_LOGNORMAL) cout << " (sigma " << setprecision(2) << config.dwellSigma << setprecision(1) << ")";
+    if (config.dwell == DWELL_EMPIRICAL) cout << " (" << config.observedStays.size() << " observed)";
+    cout << ", mix " << setprecision(0) << 100 * (1 - config.truckShare - config.motorbikeShare) << "% car / "
+         << 100 * config.truckShare << "% truck / " << 100 * config.motorbikeShare << "% motorbike"
+         << setprecision(1) << endl;
+}
+
+// Writes the generated traffic as a trace for --replay: every arrival parks
+// at its arrival time and unparks at arrival + stay, in time order, and
+// stays that end after the horizon are left open. No lot is involved, so
+// the trace contains every arrival; replaying it on a small lot turns the
+// excess away ("full") and their unparks find nothing.
+int runTraceGeneration(WorkloadConfig config, int capacity, const string& path) {
+    applyDefaultArrivalRate(config, capacity);
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        cout << "Error: Could not create " << path << "." << endl;
+        return 1;
+    }
+
+    typedef chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    WorkloadGenerator generator(config, config.seed);
+    // Pending unparks as (exit second << 32 | vehicle): one integer compare per heap step.
+    vector<uint64_t> departures;    // Min-heap
+    const char* KIND_CODES[] = {" P CAR ", " P TRUCK ", " P MOTORBIKE "};
+    uint64_t arrivals = 0, lines = 0;
+    char plate[16];
+    bool ok;
+    {
+        OutputBuffer out(fd);
+        auto writeUnparks = [&](uint64_t until) {
+            while (!departures.empty() && departures.front() >> 32 <= until) {
+                pop_heap(departures.begin(), departures.end(), greater<uint64_t>());
+                out.appendInt(config.start + (time_t)(departures.back() >> 32));
+                out.append(" U ");
+                out.append(plate, WorkloadGenerator::formatPlate(departures.back() & 0xFFFFFFFF, plate));
+                out.append('\n');
+                departures.pop_back();
+                lines++;
+            }
+        };
+
+        Arrival arrival;
+        while (generator.next(arrival) && arrival.vehicle <= 0xFFFFFFFF) { // The key holds 32 bits of vehicle
+            uint64_t second = (uint64_t)arrival.time;
+            writeUnparks(second);
+            out.appendInt(config.start + (time_t)second);
+            out.append(KIND_CODES[arrival.kind]);
+            out.append(plate, WorkloadGenerator::formatPlate(arrival.vehicle, plate));
+            out.append('\n');
+            if (arrival.time + arrival.stay < generator.horizonSeconds()) {
+                departures.push_back((uint64_t)(arrival.time + arrival.stay) << 32 | arrival.vehicle);
+                push_heap(departures.begin(), departures.end(), greater<uint64_t>());
+            }
+            arrivals++;
+            lines++;
+        }
+        writeUnparks(UINT64_MAX);
+        ok = out.flush();
+    }
+    ok = ::close(fd) == 0 && ok;
+    double seconds = chrono::duration<double>(Clock::now() - start).count();
+    if (!ok) {
+        cout << "Error: Could not write " << path << "." << endl;
+        return 1;
+    }
+
+    cout << fixed << setprecision(1);
+    cout << "=== TRACE (" << config.days << " days, " << config.arrivalsPerHour << " arrivals/h, mean stay "
+         << config.meanStayHours << " h, seed " << config.seed << ") ===" << endl;
+    printWorkload(config, generator);
+    cout << "Wrote " << arrivals << " arrivals (" << lines << " lines) to " << path << " in " << seconds << " s";
+    if (seconds > 0) cout << " (" << setprecision(1) << lines / seconds / 1e6 << " M lines/s)";
+    cout << defaultfloat << endl;
+    return 0;
+}
+
+// DISCRETE-EVENT SIMULATION
+// Drives an empty in-memory lot with a virtual clock instead of time(0).
+// The event calendar is a min-heap on simulated time holding the next
+// arrival and every pending departure; the engine pops the earliest event,
+// moves the clock there and runs it, so idle hours cost nothing. Arrivals
+// and stays come from a WorkloadGenerator, and a driver who finds the lot
+// full drives away. Vehicles are created with the
+// simulated entry time and pay for the simulated exit time, so fees follow
+// the real pricing rules. A run is reproducible from its seed.
+struct SimulationConfig {
+    int capacity = 5000;
+    WorkloadConfig workload;
+    double warmupHours = 0;     // Leading part of workload.days that is simulated but not counted
+};
+
+enum SimEventType : uint8_t { SIM_ARRIVAL, SIM_DEPARTURE };
+
+struct SimEvent {
+    double time;            // Seconds since the start
+    uint64_t sequence;      // Orders events at the same time by scheduling order
+    SimEventType type;
+    uint64_t vehicle;       // Vehicle number, encoded in its plate (departures)
+
+    bool operator>(const SimEvent& other) const {
+        return time != other.time ? time > other.time : sequence > other.sequence;
+    }
+};
+
+struct SimulationStats {
+    uint64_t events = 0;
+    uint64_t arrivals[3] = {0, 0, 0};   // Per VehicleKind
+    uint64_t turnedAway[3] = {0, 0, 0};
+    uint64_t departures = 0;
+    int peakOccupancy = 0;
+    double occupiedSpotSeconds = 0;     // Integral of the occupancy over time
+    double revenue = 0;
+};
+
+class ParkingSimulation {
+private:
+    const SimulationConfig& config;
+    ParkingLot& lot;
+    WorkloadGenerator workload;
+    Arrival upcoming;           // The arrival on the calendar
+    vector<SimEvent> calendar;  // Min-heap
+    uint64_t nextSequence;
+    double now;                 // The virtual clock
+    double measureFrom;         // End of the warm-up
+    double horizon;
+    int occupied;
+    SimulationStats stats;
+
+    void schedule(double time, SimEventType type, uint64_t vehicle) {
+        calendar.push_back({time, nextSequence++, type, vehicle});
+        push_heap(calendar.begin(), calendar.end(), greater<SimEvent>());
+    }
+
+    time_t wallClock() const { return config.workload.start + (time_t)now; }
+    bool measuring() const { return now >= measureFrom; }
+
+    // Moves the clock, adding the occupancy of the counted part of the interval.
+    void advance(double to) {
+        if (to > measureFrom) stats.occupiedSpotSeconds += occupied * (to - max(now, measureFrom));
+        if (now < measureFrom && to >= measureFrom) stats.peakOccupancy = occupied;
+        now = to;
+    }
+
+    void arrive() {
+        Vehicle* v = createVehicle(upcoming.kind, WorkloadGenerator::plateOf(upcoming.vehicle), wallClock());
+        bool parked = lot.park(v).status == PARK_OK;
+        if (parked) {
+            occupied++;
+            schedule(now + upcoming.stay, SIM_DEPARTURE, upcoming.vehicle);
+        }
+        if (measuring()) {
+            stats.arrivals[upcoming.kind]++;
+            if (parked) stats.peakOccupancy = max(stats.peakOccupancy, occupied);
+            else stats.turnedAway[upcoming.kind]++;
+        }
+        if (workload.next(upcoming)) schedule(upcoming.time, SIM_ARRIVAL, 0);
+    }
+
+    void depart(uint64_t vehicle) {
+        UnparkResult result = lot.unpark(WorkloadGenerator::plateOf(vehicle), wallClock());
+        if (!result.found) return;
+        occupied--;
+        if (measuring()) {
+            stats.departures++;
+            stats.revenue += result.fee;
+        }
+    }
+
+public:
+    ParkingSimulation(const SimulationConfig& config, ParkingLot& lot, uint64_t seed)
+        : config(config), lot(lot), workload(config.workload, seed), nextSequence(0), now(0),
+          measureFrom(config.warmupHours * 3600), horizon(config.workload.days * 86400), occupied(0) {}
+
+    void run() {
+        calendar.reserve(config.capacity + 1);
+        if (workload.next(upcoming)) schedule(upcoming.time, SIM_ARRIVAL, 0);
+        while (!calendar.empty() && calendar.front().time < horizon) {
+            pop_heap(calendar.begin(), calendar.end(), greater<SimEvent>());
+            SimEvent event = calendar.back();
+            calendar.pop_back();
+
+            advance(event.time);
+            stats.events++;
+            if (event.type == SIM_ARRIVAL) arrive();
+            else depart(event.vehicle);
+        }
+        advance(horizon);
+    }
+
+    const SimulationStats& results() const { return stats; }
+    const WorkloadGenerator& generator() const { return workload; }
+    int stillParked() const { return occupied; }
+};
+
+int runSimulation(SimulationConfig config) {
+    applyDefaultArrivalRate(config.workload, config.capacity);
+    const WorkloadConfig& workload = config.workload;
+
+    StorageOptions options;
+    options.persistent = false; // Simulated traffic never touches the data files
+    ParkingLot lot(config.capacity, options);
+    ParkingSimulation simulation(config, lot, workload.seed);
+
+    typedef chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    simulation.run();
+    double seconds = chrono::duration<double>(Clock::now() - start).count();
+
+    const SimulationStats& stats = simulation.results();
+    uint64_t arrivals = stats.arrivals[KIND_CAR] + stats.arrivals[KIND_TRUCK] + stats.arrivals[KIND_MOTORBIKE];
+    uint64_t turnedAway = stats.turnedAway[KIND_CAR] + stats.turnedAway[KIND_TRUCK] + stats.turnedAway[KIND_MOTORBIKE];
+    cout << fixed << setprecision(1);
+    cout << "=== SIMULATION (" << workload.days << " days, " << config.capacity << " spots, "
+         << workload.arrivalsPerHour << " arrivals/h, mean stay " << workload.meanStayHours << " h, seed " << workload.seed << ") ===" << endl;
+    printWorkload(workload, simulation.generator());
+    cout << "Arrivals: " << arrivals;
+    for (int kind = KIND_CAR; kind <= KIND_MOTORBIKE; kind++) {
+        cout << (kind == KIND_CAR ? " (" : ", ") << vehicleKindName(kind) << " " << stats.arrivals[kind];
+    }
+    cout << ")" << endl;
+    cout << "Turned away (lot full): " << turnedAway << " (" << setprecision(2)
+         << (arrivals ? 100.0 * turnedAway / arrivals : 0.0) << "%)" << setprecision(1) << endl;
+    cout << "Departures: " << stats.departures << ", still parked at the end: " << simulation.stillParked() << endl;
+    cout << "Occupancy: average "
+         << (workload.days > 0 ? 100.0 * stats.occupiedSpotSeconds / (workload.days * 86400) / config.capacity : 0.0)
+         << "%, peak " << stats.peakOccupancy << "/" << config.capacity << endl;
+    cout << setprecision(2) << "Revenue: $" << stats.revenue << " (average fee $"
+         << (stats.departures ? stats.revenue / stats.departures : 0.0) << ")" << endl;
+    cout << setprecision(1) << "Events: " << stats.events << " in " << seconds << " s";
+    if (seconds > 0) {
+        cout << " (" << setprecision(0) << stats.events / seconds << " events/s, " << setprecision(1)
+             << workload.days / seconds << " simulated days per second)";
+    }
+    cout << defaultfloat << endl;
+    return 0;
+}
+
+// MONTE CARLO CAPACITY PLANNING
+// Answers "how many spots keep the share of turned-away drivers below X%"
+// by simulating many independent days. Every run gets its own in-memory lot
+// and its own random stream and starts empty 'warmupHours' before the
+// counted day, so it begins with a realistic occupancy; run r starts r days
+// into the week, so weekdays and weekends are equally represented. Runs share nothing,
+// so they are spread over a ThreadPool and scale with the number of cores;
+// each writes its SimulationStats into its own slot. Results are reported
+// as means with 95% confidence intervals (normal approximation, fine for
+// the hundreds of runs this is meant for).
+//
+// The capacity search evaluates candidate sizes with the same run seeds
+// (common random numbers): every candidate sees exactly the same traffic,
+// so the comparison between sizes is not blurred by sampling noise and the
+// turned-away share falls monotonically with the capacity.
+struct MonteCarloConfig {
+    int runs = 1000;
+    double warmupHours = 12;
+    unsigned threads = 0;           // 0: all cores
+    bool planCapacity = false;
+    double targetTurnedAway = 1.0;  // Percent, for the capacity search
+};
+
+// Mean and half width of the 95% confidence interval.
+struct Estimate {
+    double mean;
+    double margin;
+};
+
+Estimate estimateMean(const vector<double>& samples) {
+    double n = samples.size(), sum = 0, squares = 0;
+    for (double x : samples) sum += x;
+    double mean = n > 0 ? sum / n : 0;
+    for (double x : samples) squares += (x - mean) * (x - mean);
+    double margin = n > 1 ? 1.96 * sqrt(squares / (n - 1) / n) : 0;
+    return {mean, margin};
+}
+
+struct MonteCarloResult {
+    Estimate turnedAway;            // Percent of all arrivals (a ratio of sums)
+    double worstRunsTurnedAway;     // 95th percentile of the per-run percentage
+    int runsAboveTarget;
+    Estimate peakOccupancy;
+    Estimate averageOccupancy;      // Percent
+    Estimate revenuePerDay;
+    uint64_t events;
+};
+
+// Seed of run 'run': SplitMix64 of the base seed and the run number, so
+// neighbouring runs (and neighbouring --seed values) get unrelated streams.
+inline uint64_t runSeed(uint64_t seed, uint64_t run) {
+    uint64_t z = seed * 0x9E3779B97F4A7C15ull + (run + 1) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Runs 'options.runs' simulations; run r uses weekdays[r % 7].
+MonteCarloResult runMonteCarlo(const vector<SimulationConfig>& weekdays, const MonteCarloConfig& options, ThreadPool& pool) {
+    vector<SimulationStats> runs(options.runs);
+    pool.parallelFor(runs.size(), [&](size_t run) {
+        const SimulationConfig& config = weekdays[run % weekdays.size()];
+        StorageOptions storage;
+        storage.persistent = false;
+        ParkingLot lot(config.capacity, storage);
+        ParkingSimulation simulation(config, lot, runSeed(config.workload.seed, run));
+        simulation.run();
+        runs[run] = simulation.results();
+    });
+
+    // The turned-away share is a ratio of sums; its interval comes from the
+    // delta method: the spread of (turned away - share * arrivals) per run.
+    const SimulationConfig& config = weekdays.front();
+    double days = config.workload.days - config.warmupHours / 24;
+    double arrivals = 0, turnedAway = 0;
+    vector<double> percents, peaks, occupancies, revenues;
+    MonteCarloResult result;
+    result.events = 0;
+    for (const SimulationStats& stats : runs) {
+        double runArrivals = stats.arrivals[KIND_CAR] + stats.arrivals[KIND_TRUCK] + stats.arrivals[KIND_MOTORBIKE];
+        double runTurnedAway = stats.turnedAway[KIND_CAR] + stats.turnedAway[KIND_TRUCK] + stats.turnedAway[KIND_MOTORBIKE];
+        arrivals += runArrivals;
+        turnedAway += runTurnedAway;
+        percents.push_back(runArrivals > 0 ? 100.0 * runTurnedAway / runArrivals : 0.0);
+        peaks.push_back(stats.peakOccupancy);
+        occupancies.push_back(100.0 * stats.occupiedSpotSeconds / (days * 86400) / config.capacity);
+        revenues.push_back(stats.revenue / days);
+        result.events += stats.events;
+    }
+    double share = arrivals > 0 ? turnedAway / arrivals : 0;
+    double n = runs.size(), meanArrivals = arrivals / n, squares = 0;
+    for (const SimulationStats& stats : runs) {
+        double runArrivals = stats.arrivals[KIND_CAR] + stats.arrivals[KIND_TRUCK] + stats.arrivals[KIND_MOTORBIKE];
+        double runTurnedAway = stats.turnedAway[KIND_CAR] + stats.turnedAway[KIND_TRUCK] + stats.turnedAway[KIND_MOTORBIKE];
+        squares += (runTurnedAway - share * runArrivals) * (runTurnedAway - share * runArrivals);
+    }
+    double margin = n > 1 && meanArrivals > 0 ? 1.96 * sqrt(squares / (n - 1) / n) / meanArrivals : 0;
+    result.turnedAway = {100 * share, 100 * margin};
+    result.runsAboveTarget = (int)count_if(percents.begin(), percents.end(), [&](double p) { return p >= options.targetTurnedAway; });
+    sort(percents.begin(), percents.end());
+    result.worstRunsTurnedAway = percents.empty() ? 0 : percents[(size_t)(0.95 * (percents.size() - 1))];
+    result.peakOccupancy = estimateMean(peaks);
+    result.averageOccupancy = estimateMean(occupancies);
+    result.revenuePerDay = estimateMean(revenues);
+    return result;
+}
+
+// The search criterion: the whole confidence interval is below the target.
+inline bool meetsTarget(const MonteCarloResult& result, double targetPercent) {
+    return result.turnedAway.mean + result.turnedAway.margin < targetPercent;
+}
+
+void printMonteCarloResult(const MonteCarloResult& result, int capacity, double targetPercent) {
+    cout << fixed << setprecision(2);
+    cout << "Turned away: " << result.turnedAway.mean << "% +/- " << result.turnedAway.margin << "% (95% CI); 95% of runs below "
+         << result.worstRunsTurnedAway << "%, " << result.runsAboveTarget << " runs at or above " << targetPercent << "%" << endl;
+    cout << setprecision(1) << "Peak occupancy: " << result.peakOccupancy.mean << " +/- " << result.peakOccupancy.margin
+         << " of " << capacity << "; average " << result.averageOccupancy.mean << "% +/- " << result.averageOccupancy.margin << "%" << endl;
+    cout << setprecision(2) << "Revenue per day: $" << result.revenuePerDay.mean << " +/- $" << result.revenuePerDay.margin
+         << defaultfloat << endl;
+}
+
+int runMonteCarloPlanning(SimulationConfig config, const MonteCarloConfig& options) {
+    // The traffic stays the same while the capacity changes.
+    applyDefaultArrivalRate(config.workload, config.capacity);
+    ThreadPool pool(options.threads > 0 ? options.threads : max(1u, thread::hardware_concurrency()));
+
+    // Each run starts empty 'warmupHours' before its counted days.
+    WorkloadConfig& workload = config.workload;
+    double countedDays = workload.days;
+    config.warmupHours = options.warmupHours;
+    workload.days += config.warmupHours / 24;
+    workload.start -= (time_t)(config.warmupHours * 3600);
+    vector<SimulationConfig> weekdays(7, config);
+    for (int day = 0; day < 7; day++) weekdays[day].workload.start += day * 86400;
+
+    typedef chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    uint64_t events = 0;
+    int evaluations = 0;
+    auto evaluate = [&](int capacity) {
+        for (SimulationConfig& weekday : weekdays) weekday.capacity = capacity;
+        MonteCarloResult result = runMonteCarlo(weekdays, options, pool);
+        events += result.events;
+        evaluations++;
+        return result;
+    };
+
+    cout << fixed << setprecision(1);
+    cout << "=== MONTE CARLO (" << options.runs << " runs of " << countedDays << " days after " << config.warmupHours
+         << " h warm-up, " << workload.arrivalsPerHour << " arrivals/h, mean stay " << workload.meanStayHours
+         << " h, seed " << workload.seed << ", " << pool.size() << " threads) ===" << endl;
+    printWorkload(workload, WorkloadGenerator(workload, workload.seed));
+
+    int capacity = config.capacity;
+    MonteCarloResult result = evaluate(capacity);
+    if (options.planCapacity) {
+        // Bracket the answer by halving / doubling, then bisect: 'low' fails, 'high' meets the target.
+        cout << setprecision(2);
+        auto report = [&](int spots, const MonteCarloResult& r) {
+            cout << "  " << setw(7) << spots << " spots: " << r.turnedAway.mean << "% +/- " << r.turnedAway.margin
+                 << "% turned away" << (meetsTarget(r, options.targetTurnedAway) ? "" : "  (too few)") << endl;
+        };
+        report(capacity, result);
+        int low = 0, high = 0;
+        MonteCarloResult best = result;
+        if (meetsTarget(result, options.targetTurnedAway)) {
+            high = capacity;
+            while (high > 1) {
+                int candidate = high / 2;
+                MonteCarloResult r = evaluate(candidate);
+                report(candidate, r);
+                if (!meetsTarget(r, options.targetTurnedAway)) {
+                    low = candidate;
+                    break;
+                }
+                high = candidate;
+                best = r;
+            }
+        } else {
+            low = capacity;
+            while (true) {
+                if (low > INT_MAX / 2) {
+                    cout << "Error: No capacity below " << INT_MAX << " meets the target." << endl;
+                    return 1;
+                }
+                int candidate = low * 2;
+                MonteCarloResult r = evaluate(candidate);
+                report(candidate, r);
+                if (meetsTarget(r, options.targetTurnedAway)) {
+                    high = candidate;
+                    best = r;
+                    break;
+                }
+                low = candidate;
+            }
+        }
+        while (high - low > 1) {
+            int candidate = low + (high - low) / 2;
+            MonteCarloResult r = evaluate(candidate);
+            report(candidate, r);
+            if (meetsTarget(r, options.targetTurnedAway)) {
+                high = candidate;
+                best = r;
+            } else {
+                low = candidate;
+            }
+        }
+        cout << "Smallest capacity with fewer than " << options.targetTurnedAway << "% turned away (95% confidence): "
+             << high << " spots" << endl;
+        capacity = high;
+        result = best;
+    }
+    printMonteCarloResult(result, capacity, options.targetTurnedAway);
+
+    double seconds = chrono::duration<double>(Clock::now() - start).count();
+    cout << fixed << setprecision(1) << "Time: " << seconds << " s for " << evaluations * options.runs << " runs";
+    if (seconds > 0) {
+        cout << " (" << setprecision(0) << evaluations * options.runs / seconds << " runs/s, " << events / seconds
+             << " events/s)";
+    }
+    cout << defaultfloat << endl;
+    return 0;
+}
+
+// PARAMETER SWEEP
+// Simulates every point of a capacity x hourly rate x minimum charge grid
+// and streams one CSV row per point as soon as it finishes. The rate is the
+// car rate; trucks and motorbikes keep their standard ratio to it. Demand
+// can react to the price: with a price elasticity E, the arrival rate is
+// scaled by (car rate / standard car rate)^-E.
+// Points differ a lot in length (a small lot turns most drivers away, so
+// it has few departures; a cheap tariff attracts more traffic). The pool's
+// workers pick the next point whenever they finish one, and points are
+// handed out longest first by their expected number of events, so the short
+// ones fill the gaps at the end instead of one long point running alone.
+// Every point uses the same seed: rows differ by their parameters, not by
+// their random traffic.
+struct SweepConfig {
+    vector<double> capacities;
+    vector<double> carRates;
+    vector<double> minimumHours;
+    double priceElasticity = 0;
+    string path;
+};
+
+struct SweepPoint {
+    int capacity;
+    Tariff tariff;
+    double arrivalsPerHour;
+    double expectedEvents;      // Decides the order of the work
+};
+
+// Longest list a grid axis may have; a range like "0:1e12:1" is rejected
+// instead of allocating its values.
+const size_t MAX_GRID_VALUES = 10000;
+
+// A whole token as a finite number (from_chars: no locale, no blanks, no inf/nan).
+bool parseFiniteNumber(string_view text, double& value) {
+    from_chars_result parsed = from_chars(text.data(), text.data() + text.size(), value);
+    return !text.empty() && parsed.ec == errc() && parsed.ptr == text.data() + text.size() && isfinite(value);
+}
+
+// Parses "a,b,c" or an inclusive range "from:to:step" into 'values'.
+bool parseGrid(string_view text, vector<double>& values) {
+    values.clear();
+    size_t colon = text.find(':');
+    if (colon != string_view::npos) {
+        size_t second = text.find(':', colon + 1);
+        double from, to, step;
+        if (second == string_view::npos || !parseFiniteNumber(text.substr(0, colon), from)
+            || !parseFiniteNumber(text.substr(colon + 1, second - colon - 1), to)
+            || !parseFiniteNumber(text.substr(second + 1), step) || step <= 0 || to < from) {
+            return false;
+        }
+        double count = floor((to - from) / step + 1e-9) + 1;
+        if (count > MAX_GRID_VALUES) return false;
+        for (int i = 0; i < (int)count; i++) values.push_back(from + i * step);
+        return true;
+    }
+    while (true) {
+        size_t comma = text.find(',');
+        double value;
+        if (!parseFiniteNumber(text.substr(0, comma), value) || values.size() == MAX_GRID_VALUES) return false;
+        values.push_back(value);
+        if (comma == string_view::npos) return true;
+        text.remove_prefix(comma + 1);
+    }
+}
+
+int runSweep(SimulationConfig config, const SweepConfig& sweep, const MonteCarloConfig& options) {
+    // Demand is set once and only reacts to the price. Without --arrival-rate
+    // it is 80% load at the largest capacity of the grid (not --capacity), so
+    // all sizes are compared on traffic that the biggest one can handle.
+    bool defaultRate = config.workload.arrivalsPerHour <= 0;
+    applyDefaultArrivalRate(config.workload, (int)*max_element(sweep.capacities.begin(), sweep.capacities.end()));
+    WorkloadConfig& workload = config.workload;
+    double countedDays = workload.days;
+    config.warmupHours = options.warmupHours;
+    workload.days += config.warmupHours / 24;
+    workload.start -= (time_t)(config.warmupHours * 3600);
+
+    vector<SweepPoint> points;
+    for (double capacity : sweep.capacities) {
+        for (double carRate : sweep.carRates) {
+            for (double minimum : sweep.minimumHours) {
+                SweepPoint point;
+                point.capacity = (int)capacity;     // Checked to be 1 .. INT_MAX
+                double scale = carRate / STANDARD_TARIFF.hourlyRate[KIND_CAR];
+                for (int kind = KIND_CAR; kind <= KIND_MOTORBIKE; kind++) {
+                    point.tariff.hourlyRate[kind] = STANDARD_TARIFF.hourlyRate[kind] * scale;
+                }
+                point.tariff.minimumHours = max(0.0, minimum);
+                point.arrivalsPerHour = workload.arrivalsPerHour * (scale > 0 ? pow(scale, -sweep.priceElasticity) : 1.0);
+                // Every arrival is an event; only the admitted ones depart again.
+                double arrivals = point.arrivalsPerHour * workload.days * 24;
+                double admitted = min(1.0, point.capacity / max(1e-9, point.arrivalsPerHour * workload.meanStayHours));
+                point.expectedEvents = arrivals * (1 + admitted);
+                points.push_back(point);
+            }
+        }
+    }
+    vector<size_t> order(points.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return points[a].expectedEvents > points[b].expectedEvents; });
+
+    int fd = ::open(sweep.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        cout << "Error: Could not create " << sweep.path << "." << endl;
+        return 1;
+    }
+    ThreadPool pool(options.threads > 0 ? options.threads : max(1u, thread::hardware_concurrency()));
+    cout << fixed << setprecision(1);
+    cout << "=== PARAMETER SWEEP (" << points.size() << " points: " << sweep.capacities.size() << " capacities x "
+         << sweep.carRates.size() << " rates x " << sweep.minimumHours.size() << " minimum charges, " << countedDays
+         << " days after " << config.warmupHours << " h warm-up, " << pool.size() << " threads, "
+         << workload.arrivalsPerHour << " arrivals/h" << (defaultRate ? " = 80% load at the largest capacity" : "")
+         << ") ===" << endl;
+    printWorkload(workload, WorkloadGenerator(workload, workload.seed));
+
+    typedef chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    mutex outputMutex;          // Guards everything below
+    bool ok;
+    uint64_t events = 0;
+    double busySeconds = 0;
+    double bestRevenue = -1;
+    size_t best = 0;
+    double bestTurnedAway = 0;
+    {
+        OutputBuffer out(fd);
+        RowWriter writer(out, EXPORT_CSV, {"point", "capacity", "car_rate", "truck_rate", "motorbike_rate", "minimum_hours",
+                                           "arrivals_per_hour", "arrivals", "turned_away_pct", "average_occupancy_pct",
+                                           "peak_occupancy", "revenue_per_day", "average_fee", "events", "seconds"});
+        out.flush();
+        pool.parallelFor(order.size(), [&](size_t task) {
+            size_t index = order[task];
+            const SweepPoint& point = points[index];
+            Clock::time_point pointStart = Clock::now();
+
+            SimulationConfig run = config;
+            run.capacity = point.capacity;
+            run.workload.arrivalsPerHour = point.arrivalsPerHour;
+            StorageOptions storage;
+            storage.persistent = false;
+            ParkingLot lot(run.capacity, storage);
+            lot.setTariff(&point.tariff);
+            ParkingSimulation simulation(run, lot, workload.seed);
+            simulation.run();
+            const SimulationStats& stats = simulation.results();
+            double seconds = chrono::duration<double>(Clock::now() - pointStart).count();
+
+            uint64_t arrivals = stats.arrivals[KIND_CAR] + stats.arrivals[KIND_TRUCK] + stats.arrivals[KIND_MOTORBIKE];
+            uint64_t turnedAway = stats.turnedAway[KIND_CAR] + stats.turnedAway[KIND_TRUCK] + stats.turnedAway[KIND_MOTORBIKE];
+            double turnedAwayPercent = arrivals ? 100.0 * turnedAway / arrivals : 0.0;
+            double revenuePerDay = stats.revenue / countedDays;
+
+            lock_guard<mutex> lock(outputMutex);
+            writer.integer(index);
+            writer.integer(point.capacity);
+            writer.number(point.tariff.hourlyRate[KIND_CAR], 2);
+            writer.number(point.tariff.hourlyRate[KIND_TRUCK], 2);
+            writer.number(point.tariff.hourlyRate[KIND_MOTORBIKE], 2);
+            writer.number(point.tariff.minimumHours, 2);
+            writer.number(point.arrivalsPerHour, 1);
+            writer.integer(arrivals);
+            writer.number(turnedAwayPercent, 3);
+            writer.number(100.0 * stats.occupiedSpotSeconds / (countedDays * 86400) / point.capacity, 2);
+            writer.integer(stats.peakOccupancy);
+            writer.cents(llround(revenuePerDay * 100));
+            writer.cents(llround((stats.departures ? stats.revenue / stats.departures : 0.0) * 100));
+            writer.integer(stats.events);
+            writer.number(seconds, 3);
+            writer.endRow();
+            out.flush();    // Finished points can be watched while the sweep runs
+
+            events += stats.events;
+            busySeconds += seconds;
+            if (revenuePerDay > bestRevenue || (revenuePerDay == bestRevenue && index < best)) { // Ties: the smallest lot
+                bestRevenue = revenuePerDay;
+                best = index;
+                bestTurnedAway = turnedAwayPercent;
+            }
+        });
+        ok = writer.finish();
+    }
+    ok = ::close(fd) == 0 && ok;
+    double seconds = chrono::duration<double>(Clock::now() - start).count();
+    if (!ok) {
+        cout << "Error: Could not write " << sweep.path << "." << endl;
+        return 1;
+    }
+
+    cout << fixed << setprecision(1) << "Wrote " << points.size() << " rows to " << sweep.path << " in " << seconds << " s";
+    if (seconds > 0) {
+        cout << " (" << setprecision(0) << events / seconds << " events/s, workers busy " << setprecision(1)
+             << 100 * busySeconds / (seconds * pool.size()) << "% of the time)";
+    }
+    cout << endl;
+    const SweepPoint& top = points[best];
+    cout << setprecision(2) << "Best revenue: $" << bestRevenue << " per day at " << top.capacity << " spots, car rate $"
+         << top.tariff.hourlyRate[KIND_CAR] << "/h, minimum " << top.tariff.minimumHours << " h (" << bestTurnedAway
+         << "% turned away)" << defaultfloat << endl;
+    return 0;
+}
+
+// BINARY WIRE PROTOCOL
+// Fixed 32-byte requests and responses in host byte order (little-endian on
+// every platform this runs on), for gate controllers that do not want to
+// format and parse text. A connection whose first byte is WIRE_MAGIC speaks
+// this protocol for its whole life; every request starts with the magic
+// byte as well, so a client that lost track of the framing is disconnected
+// instead of executing garbage. Requests are answered in order and may be
+// pipelined freely: the server runs every complete request of a read.
+// Ticket IDs are journal sequence numbers: the park event for a park, the
+// unpark event (the receipt) for an unpark.
+const uint8_t WIRE_MAGIC = 0xA7;   // Not a byte any text command starts with
+
+enum WireOp : uint8_t {
+    WIRE_PARK = 1,
+    WIRE_UNPARK = 2,
+    WIRE_QUOTE = 3,     // Fee if the vehicle left now; nothing changes
+    WIRE_STATUS = 4     // Occupancy and revenue
+};
+
+enum WireStatus : uint8_t {
+    WIRE_OK = 0,
+    WIRE_FULL = 1,
+    WIRE_DUPLICATE = 2,
+    WIRE_PLATE_TOO_LONG = 3,
+    WIRE_NOT_FOUND = 4,
+    WIRE_BAD_REQUEST = 5
+};
+
+struct WireRequest {
+    uint8_t magic;          // WIRE_MAGIC
+    uint8_t op;             // WireOp
+    uint8_t kind;           // VehicleKind, park only
+    uint8_t reserved;
+    uint32_t requestId;     // Chosen by the client, echoed in the response
+    char plate[16];         // NUL padded, as in the snapshot
+    uint8_t reserved2[8];
+};
+static_assert(sizeof(WireRequest) == 32, "WireRequest layout must stay fixed");
+
+struct WireResponse {
+    uint8_t magic;          // WIRE_MAGIC
+    uint8_t op;             // Echoed
+    uint8_t status;         // WireStatus
+    uint8_t kind;           // VehicleKind (park, unpark, quote)
+    uint32_t requestId;     // Echoed
+    int32_t spot;           // Spot (park, unpark, quote); occupied spots for status
+    int32_t capacity;       // Status only
+    uint64_t ticket;        // Journal sequence number (park, unpark)
+    int64_t cents;          // Fee (unpark, quote) or total revenue (status)
+};
+static_assert(sizeof(WireResponse) == 32, "WireResponse layout must stay fixed");
+
+// Executes one request and fills in its response. 'deferredLsn': see runCommand().
+void runWireRequest(ParkingLot& lot, const WireRequest& request, WireResponse& response, uint64_t* deferredLsn = nullptr) {
+    memset(&response, 0, sizeof(response));
+    response.magic = WIRE_MAGIC;
+    response.op = request.op;
+    response.requestId = request.requestId;
+    response.spot = -1;
+
+    size_t plateLength = strnlen(request.plate, sizeof(request.plate));
+    bool needsPlate = request.op == WIRE_PARK || request.op == WIRE_UNPARK || request.op == WIRE_QUOTE;
+    if (needsPlate && plateLength == 0) {
+        response.status = WIRE_BAD_REQUEST;
+        return;
+    }
+    string plate(request.plate, plateLength);
+
+    switch (request.op) {
+        case WIRE_PARK: {
+            Vehicle* v = createVehicle(request.kind, plate, time(0));
+            if (v == nullptr) {
+                response.status = WIRE_BAD_REQUEST;
+                return;
+            }
+            ParkResult result = lot.park(v, deferredLsn == nullptr);
+            if (deferredLsn != nullptr) *deferredLsn = max(*deferredLsn, result.lsn);
+            const WireStatus STATUS[] = {WIRE_OK, WIRE_FULL, WIRE_PLATE_TOO_LONG, WIRE_DUPLICATE};
+            response.status = STATUS[result.status];
+            response.kind = request.kind;
+            response.spot = result.spot;
+            response.ticket = result.lsn;
+            break;
+        }
+        case WIRE_UNPARK:
+        case WIRE_QUOTE: {
+            UnparkResult result = request.op == WIRE_UNPARK ? lot.unpark(plate, 0, deferredLsn == nullptr) : lot.quote(plate);
+            if (deferredLsn != nullptr) *deferredLsn = max(*deferredLsn, result.lsn);
+            response.status = result.found ? WIRE_OK : WIRE_NOT_FOUND;
+            response.kind = result.kind;
+            response.spot = result.spot;
+            response.ticket = result.lsn;
+            response.cents = llround(result.fee * 100);
+            break;
+        }
+        case WIRE_STATUS: {
+            LotSummary summary = lot.summary();
+            response.spot = summary.occupied;
+            response.capacity = summary.capacity;
+            response.cents = llround(summary.revenue * 100);
+            break;
+        }
+        default:
+            response.status = WIRE_BAD_REQUEST;
+    }
+}
+
+// Runs every complete request in 'data' and appends the responses to 'out'.
+// Returns the number of bytes used; sets 'desynced' (and stops) at a request
+// without the magic byte.
+size_t runWireRequests(ParkingLot& lot, const char* data, size_t size, OutputBuffer& out,
+                       CommandCounters& counters, bool& desynced, uint64_t* deferredLsn = nullptr) {
+    size_t used = 0;
+    desynced = false;
+    for (; used + sizeof(WireRequest) <= size; used += sizeof(WireRequest)) {
+        WireRequest request;
+        memcpy(&request, data + used, sizeof(request)); // The read buffer is not aligned for it
+        if (request.magic != WIRE_MAGIC) {
+            desynced = true;
+            break;
+        }
+        WireResponse response;
+        runWireRequest(lot, request, response, deferredLsn);
+        out.append((const char*)&response, sizeof(response));
+        counters.commands++;
+        if (response.status == WIRE_BAD_REQUEST) counters.invalid++;
+    }
+    return used;
+}
+
+// SELF-CHECK: GATE PROTOCOLS
+// Feeds the batch/text and binary wire parsers the inputs that gate
+// controllers get wrong: malformed lines, query options, over-long plates and
+// a lost request frame. Commands run on a throwaway lot and answer into a
+// file-less OutputBuffer, so the answers can be compared byte for byte.
+
+// Runs 'input' as one batch and returns the answers.
+string runCheckCommands(ParkingLot& lot, string_view input, CommandCounters& counters) {
+    OutputBuffer out;
+    runCommandLines(lot, input.data(), input.size(), true, out, counters);
+    return string(out.data(), out.size());
+}
+
+// Plates of the rows of a "Q" answer, after its header line.
+vector<string> queryPlates(string_view answer) {
+    vector<string> plates;
+    size_t newline = answer.find('\n');
+    while (newline != string_view::npos && newline + 1 < answer.size()) {
+        answer.remove_prefix(newline + 1);
+        newline = answer.find('\n');
+        string_view row = answer.substr(0, newline);
+        nextToken(row); // Spot
+        nextToken(row); // Type
+        plates.push_back(string(nextToken(row)));
+    }
+    return plates;
+}
+
+WireRequest checkWireRequest(uint8_t op, const char* plate, size_t plateLength) {
+    WireRequest request;
+    memset(&request, 0, sizeof(request));
+    request.magic = WIRE_MAGIC;
+    request.op = op;
+    request.kind = KIND_CAR;
+    memcpy(request.plate, plate, min(plateLength, sizeof(request.plate)));
+    return request;
+}
+
+// Every malformed line answers "ERR SYNTAX <line>" with its own line number;
+// blank lines and comments count as lines but get no answer.
+bool checkMalformedLines(string& detail) {
+    StorageOptions options;
+    options.persistent = false;
+    ParkingLot lot(10, options);
+    CommandCounters counters;
+    string answers = runCheckCommands(lot,
+        "P CAR A1\n"
+        "PARK CAR A2\n"
+        "\n"
+        "# comment\n"
+        "P BOAT A3\n"
+        "U\n"
+        "Q limit=abc\n"
+        "Q bogus\n"
+        "S extra\n"
+        "S", counters);
+    const string expected =
+        "OK P A1 0\n"
+        "ERR SYNTAX 2\n"
+        "ERR SYNTAX 5\n"
+        "ERR SYNTAX 6\n"
+        "ERR SYNTAX 7\n"
+        "ERR SYNTAX 8\n"
+        "ERR SYNTAX 9\n"
+        "OK S 1 10 0.00\n";
+    if (answers != expected || counters.lines != 10 || counters.commands != 2 || counters.invalid != 6) {
+        detail = "unexpected answers:\n" + answers;
+        return false;
+    }
+    return true;
+}
+
+// A query page honours the filter, the order and offset/limit, and says
+// whether more rows follow.
+bool checkStatusQueryPaging(string& detail) {
+    StorageOptions options;
+    options.persistent = false;
+    ParkingLot lot(10, options);
+    const char* plates[] = {"DD4", "BB2", "EE5", "AA1", "CC3"};
+    for (int i = 0; i < 5; i++) lot.park(createVehicle(KIND_CAR, plates[i], CHECK_ENTRY + i * 60));
+    lot.park(createVehicle(KIND_TRUCK, "TT1", CHECK_ENTRY));
+
+    struct Case {
+        const char* command;
+        const char* header;
+        vector<string> plates;
+    };
+    const Case cases[] = {
+        {"Q type=car sort=plate limit=2", "OK Q 2 5 more", {"AA1", "BB2"}},
+        {"Q type=car sort=plate offset=2 limit=2", "OK Q 2 5 more", {"CC3", "DD4"}},
+        {"Q type=car sort=plate offset=4 limit=2", "OK Q 1 5 end", {"EE5"}},
+        {"Q type=car sort=plate desc limit=3", "OK Q 3 5 more", {"EE5", "DD4", "CC3"}},
+        {"Q type=car sort=entry desc offset=1 limit=2", "OK Q 2 5 more", {"AA1", "EE5"}},
+        {"Q sort=plate offset=100", "OK Q 0 6 end", {}},
+        {"Q prefix=T", "OK Q 1 1 end", {"TT1"}},
+    };
+    for (const Case& c : cases) {
+        CommandCounters counters;
+        string answer = runCheckCommands(lot, c.command, counters);
+        if (answer.compare(0, strlen(c.header), c.header) != 0 || queryPlates(answer) != c.plates) {
+            detail = string(c.command) + " answered:\n" + answer;
+            return false;
+        }
+    }
+    return true;
+}
+
+// A 16-byte plate fills the request's plate field without a terminating
+// NUL; it must be refused as too long, not read past or cut short.
+bool checkWirePlateLength(string& detail) {
+    StorageOptions options;
+    options.persistent = false;
+    ParkingLot lot(10, options);
+    WireResponse response;
+    runWireRequest(lot, checkWireRequest(WIRE_PARK, "ABCDEFGHIJKLMNOP", 16), response);
+    if (response.status != WIRE_PLATE_TOO_LONG || lot.summary().occupied != 0) {
+        detail = "a 16-byte plate answered status " + to_string(response.status);
+        return false;
+    }
+    runWireRequest(lot, checkWireRequest(WIRE_PARK, "ABCDEFGHIJKLMNO", 15), response);
+    if (response.status != WIRE_OK || !lot.quote("ABCDEFGHIJKLMNO").found) {
+        detail = "a 15-byte plate answered status " + to_string(response.status);
+        return false;
+    }
+    return true;
+}
+
+// A request without the magic byte ends the batch: the requests before it
+// are answered, it and everything after it are not run.
+bool checkWireDesync(string& detail) {
+    StorageOptions options;
+    options.persistent = false;
+    ParkingLot lot(10, options);
+    WireRequest requests[3] = {
+        checkWireRequest(WIRE_PARK, "W1", 2),
+        checkWireRequest(WIRE_PARK, "W2", 2),
+        checkWireRequest(WIRE_PARK, "W3", 2),
+    };
+    requests[1].magic = 0;
+    OutputBuffer out;
+    CommandCounters counters;
+    bool desynced = false;
+    size_t used = runWireRequests(lot, (const char*)requests, sizeof(requests), out, counters, desynced);
+    if (!desynced || used != sizeof(WireRequest) || out.size() != sizeof(WireResponse)) {
+        detail = "the request without the magic byte did not stop the connection";
+        return false;
+    }
+    if (!lot.quote("W1").found || lot.quote("W2").found || lot.quote("W3").found) {
+        detail = "requests after the lost frame were run";
+        return false;
+    }
+    return true;
+}
+
+// The ticket of a wire park or unpark is the sequence number of its own
+// journal record.
+bool checkWireTickets(string& detail) {
+    removeDataFiles();
+    vector<pair<string, WireResponse>> answered;
+    {
+        StorageOptions options;
+        options.journal.durability = DURABILITY_STRICT;
+        ParkingLot lot(10, options);
+        lot.park(createVehicle(KIND_CAR, "TXT1", CHECK_ENTRY)); // Tickets need not start at 1
+        const char* plates[] = {"T1", "T2", "T3"};
+        for (const char* plate : plates) {
+            WireResponse response;
+            runWireRequest(lot, checkWireRequest(WIRE_PARK, plate, strlen(plate)), response);
+            answered.push_back({plate, response});
+        }
+        WireResponse response;
+        runWireRequest(lot, checkWireRequest(WIRE_UNPARK, "T2", 2), response);
+        answered.push_back({"T2", response});
+    }
+
+    vector<char> journal;
+    if (!readWholeFile(JOURNAL_FILE, journal) || journal.size() % sizeof(JournalRecord) != 0) {
+        detail = "could not read the journal";
+        return false;
+    }
+    for (const auto& [plate, response] : answered) {
+        uint8_t op = response.op == WIRE_PARK ? JOURNAL_PARK : JOURNAL_UNPARK;
+        bool matched = false;
+        for (size_t offset = 0; offset < journal.size() && !matched; offset += sizeof(JournalRecord)) {
+            JournalRecord record;
+            memcpy(&record, &journal[offset], sizeof(record));
+            matched = record.lsn == response.ticket && record.op == op
+                      && strncmp(record.plate, plate.c_str(), sizeof(record.plate)) == 0;
+        }
+        if (response.status != WIRE_OK || !matched) {
+            detail = "ticket " + to_string(response.ticket) + " of " + plate + " is not its journal record";
+            return false;
+        }
+    }
+    return true;
+}
+
+int runSelfCheck() {
+    char scratch[] = "/tmp/parking_check_XXXXXX";
+    char* previous = getcwd(nullptr, 0);
+    if (mkdtemp(scratch) == nullptr || previous == nullptr || chdir(scratch) != 0) {
+        cout << "Error: Could not create a scratch directory." << endl;
+        free(previous);
+        return 1;
+    }
+
+    struct Check {
+        const char* name;
+        function<bool(string&)> run;
+    };
+    const Check checks[] = {
+        {"torn journal tail", [](string& d) { return checkTornJournalTail(d); }},
+        {"snapshot round trip", [](string& d) { return checkSnapshotRoundTrip(false, d); }},
+        {"snapshot round trip (lazy load)", [](string& d) { return checkSnapshotRoundTrip(true, d); }},
+        {"interrupted incremental checkpoint", [](string& d) { return checkInterruptedCheckpoint(false, d); }},
+        {"torn page log", [](string& d) { return checkInterruptedCheckpoint(true, d); }},
+        {"malformed batch lines", [](string& d) { return checkMalformedLines(d); }},
+        {"status query paging and order", [](string& d) { return checkStatusQueryPaging(d); }},
+        {"wire plate without NUL", [](string& d) { return checkWirePlateLength(d); }},
+        {"wire request without magic", [](string& d) { return checkWireDesync(d); }},
+        {"wire tickets are journal LSNs", [](string& d) { return checkWireTickets(d); }},
+    };
+    int failed = 0;
+    for (const Check& check : checks) {
+        ostringstream captured;
+        streambuf* console = cout.rdbuf(captured.rdbuf());
+        string detail;
+        bool ok = check.run(detail);
+        cout.rdbuf(console);
+        cout << (ok ? "ok      " : "FAILED  ") << check.name << endl;
+        if (!ok) {
+            failed++;
+            cout << "        " << detail << endl << captured.str();
+        }
+    }
+
+    removeDataFiles();
+    bool restored = chdir(previous) == 0;
+    free(previous);
+    rmdir(scratch);
+    cout << (failed == 0 ? "All " : "") << (sizeof(checks) / sizeof(checks[0]) - failed) << " of "
+         << sizeof(checks) / sizeof(checks[0]) << " self-checks passed." << endl;
+    return failed == 0 && restored ? 0 : 1;
+}
+
+// GATE SERVER (UNIX DOMAIN SOCKET)
+// Gate controllers connect to a local socket and speak the batch protocol
+// (one command per line, one answer per command, see runCommand()) or the
+// binary wire protocol, chosen by the first byte of the connection. Every
+// worker thread runs its own epoll loop and waits on the listening socket
+// with EPOLLEXCLUSIVE, so a new connection wakes only one of them.
+// Each connection is served by a coroutine (GateSession) that is suspended
+// whenever it has to wait: for its socket, for a journal commit or for the
+// payment simulator. A waiting gate costs its coroutine frame and buffers,
+// not a thread, so a couple of workers hold tens of thousands of gates. The
+// answers to one read are sent together once their journal records are on
+// disk (--durability=strict), and a connection is not read again until all
+// of them are sent.
+//
+// Text connections can also hold the conversation of a gate, one step per line:
+//   ENTER <TYPE> <PLATE>  -> "OPEN <plate> <spot> <ticket>" once the park is on disk
+//   EXIT <PLATE>          -> "QUOTE <plate> <type> <fee>", then
+//   PAY <AMOUNT>          -> "OPEN <plate> <ticket> <fee>": paid, unparked at the quoted fee
+//                            "DECLINED <plate> <fee>": pay again or
+//   CANCEL                -> "CANCELLED <plate>"
+// Rejections are answered as in the batch protocol ("ERR FULL <plate>", ...).
+const char* const GATE_SOCKET_FILE = "parking_gate.sock";
+const size_t SERVER_MAX_LINE = 1 << 16;
+
+// SIGINT/SIGTERM wake every worker through this eventfd.
+int serverStopFd = -1;
+
+void onServerSignal(int) {
+    uint64_t one = 1;
+    ssize_t ignored = write(serverStopFd, &one, sizeof(one));
+    (void)ignored;
+}
+
+// Fills a sockaddr_un; false if the path does not fit.
+bool unixSocketAddress(const string& path, sockaddr_un& address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) return false;
+    memcpy(address.sun_path, path.data(), path.size());
+    return true;
+}
+
+// Every gate is a socket: allow as many as the hard limit permits.
+void raiseOpenFileLimit() {
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+// "20", "20.5" or "20.50" as cents.
+bool parseCents(string_view text, int64_t& cents) {
+    size_t dot = text.find('.');
+    string_view whole = text.substr(0, dot);
+    string_view fraction = dot == string_view::npos ? string_view() : text.substr(dot + 1);
+    int64_t units;
+    from_chars_result parsed = from_chars(whole.data(), whole.data() + whole.size(), units);
+    if (whole.empty() || parsed.ec != errc() || parsed.ptr != whole.data() + whole.size()
+        || units < 0 || units > INT64_MAX / 100 - 1 || fraction.size() > 2) {
+        return false;
+    }
+    int64_t hundredths = 0;
+    for (size_t i = 0; i < 2; i++) {
+        char digit = i < fraction.size() ? fraction[i] : '0';
+        if (digit < '0' || digit > '9') return false;
+        hundredths = hundredths * 10 + (digit - '0');
+    }
+    cents = units * 100 + hundredths;
+    return true;
+}
+
+enum GateProtocol { PROTOCOL_UNKNOWN, PROTOCOL_TEXT, PROTOCOL_BINARY };
+
+// Coroutine type of a gate session. It starts suspended; its worker resumes
+// it and destroys the frame once it has finished or the server stops.
+struct GateSession {
+    struct promise_type {
+        GateSession get_return_object() { return {coroutine_handle<promise_type>::from_promise(*this)}; }
+        suspend_always initial_suspend() noexcept { return {}; }
+        suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
+    coroutine_handle<promise_type> handle;
+};
+
+struct GateConnection {
+    int fd;
+    GateProtocol protocol;  // Decided by the first byte received
+    vector<char> input;
+    size_t inputUsed;       // Bytes of an unfinished line or request
+    OutputBuffer output;    // Answers not sent yet
+    CommandCounters counters;
+    uint64_t reportedCommands;  // Part of counters.commands already added to the server total
+    coroutine_handle<> session;
+    // The socket is registered edge-triggered, so readiness is remembered
+    // here until a read or send runs into EAGAIN.
+    bool readable;
+    bool writable;
+    uint32_t waitingFor;    // EPOLLIN or EPOLLOUT while the session waits for the socket
+
+    explicit GateConnection(int fd)
+        : fd(fd), protocol(PROTOCOL_UNKNOWN), input(4096), inputUsed(0), reportedCommands(0), readable(false),
+          writable(false), waitingFor(0) {}
+};
+
+// Scheduler state of one worker thread: its connections, sessions to resume
+// because another thread said so (journal commits) and timers (payment replies).
+struct GateWorker {
+    typedef chrono::steady_clock Clock;
+
+    struct Timer {
+        Clock::time_point due;
+        GateConnection* connection;
+    };
+
+    static bool later(const Timer& a, const Timer& b) { return a.due > b.due; }
+
+    int epollFd;
+    int wakeFd;                             // eventfd, signalled by post()
+    mutex postedMutex;
+    vector<GateConnection*> posted;         // Guarded by postedMutex
+    vector<GateConnection*> resuming;
+    vector<Timer> timers;                   // Min-heap on 'due'
+    unordered_map<int, GateConnection*> open;
+    vector<GateConnection*> closed;         // Freed after the current batch of events
+    int awaitingJournal;                    // Sessions registered with whenDurable()
+
+    GateWorker() : epollFd(-1), wakeFd(-1), awaitingJournal(0) {}
+
+    ~GateWorker() {
+        if (epollFd >= 0) close(epollFd);
+        if (wakeFd >= 0) close(wakeFd);
+    }
+
+    // Any thread: have the worker resume this connection's session.
+    void post(GateConnection* c) {
+        {
+            lock_guard<mutex> lock(postedMutex);
+            posted.push_back(c);
+        }
+        uint64_t one = 1;
+        ssize_t ignored = write(wakeFd, &one, sizeof(one));
+        (void)ignored;
+    }
+
+    void addTimer(Clock::time_point due, GateConnection* c) {
+        timers.push_back({due, c});
+        push_heap(timers.begin(), timers.end(), later);
+    }
+
+    // epoll_wait timeout until the next timer, in milliseconds (-1: none).
+    int timeoutMillis() const {
+        if (timers.empty()) return -1;
+        int64_t micros = chrono::duration_cast<chrono::microseconds>(timers.front().due - Clock::now()).count();
+        return micros <= 0 ? 0 : (int)min<int64_t>((micros + 999) / 1000, INT32_MAX);
+    }
+};
+
+// What a session can wait for. Each resumes the session on its own worker.
+
+// The socket became readable (EPOLLIN) or writable (EPOLLOUT).
+struct SocketReady {
+    GateConnection* c;
+    uint32_t event;
+
+    bool await_ready() const { return event == EPOLLIN ? c->readable : c->writable; }
+    void await_suspend(coroutine_handle<>) { c->waitingFor = event; }
+    void await_resume() const {}
+};
+
+// Journal record 'lsn' is on disk. Only suspends with STRICT durability.
+struct JournalCommit {
+    ParkingLot& lot;
+    GateWorker& worker;
+    GateConnection* c;
+    uint64_t lsn;
+
+    bool await_ready() const { return lsn == 0; }
+    bool await_suspend(coroutine_handle<>) {
+        GateWorker* w = &worker;
+        GateConnection* connection = c;
+        if (!lot.whenDurable(lsn, [w, connection] { w->post(connection); })) return false; // Already durable
+        worker.awaitingJournal++;
+        return true;
+    }
+    void await_resume() const {}
+};
+
+// Stand-in for the payment processor of a pay station: replies after
+// 'latency' and approves when the tendered amount covers the fee.
+struct PaymentReply {
+    GateWorker& worker;
+    GateConnection* c;
+    chrono::microseconds latency;
+    int64_t dueCents;
+    int64_t tenderedCents;
+
+    bool await_ready() const { return latency.count() <= 0; }
+    void await_suspend(coroutine_handle<>) { worker.addTimer(GateWorker::Clock::now() + latency, c); }
+    bool await_resume() const { return tenderedCents >= dueCents; }
+};
+
+class GateServer {
+private:
+    ParkingLot& lot;
+    string path;
+    int listenFd;
+    chrono::microseconds paymentLatency;
+    atomic<uint64_t> connectionCount;
+    atomic<uint64_t> commandCount;
+
+    void acceptConnections(GateWorker& worker) {
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return; // EAGAIN: nothing left to accept
+            GateConnection* c = new GateConnection(fd);
+            epoll_event ev;
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.ptr = c;
+            if (epoll_ctl(worker.epollFd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+                close(fd);
+                delete c;
+                continue;
+            }
+            worker.open[fd] = c;
+            connectionCount++;
+            logMessage<LOG_DEBUG>(LOG_GATE_CONNECTED, KIND_UNKNOWN, string_view(), fd);
+            c->session = serveConnection(worker, c).handle;
+            resume(worker, c);
+        }
+    }
+
+    // Runs the session up to its next wait. A finished session's connection
+    // is closed; it is freed after the current batch of events, which may
+    // still mention it.
+    void resume(GateWorker& worker, GateConnection* c) {
+        if (c->session.done()) return;
+        c->session.resume();
+        if (!c->session.done()) return;
+        logMessage<LOG_DEBUG>(LOG_GATE_DISCONNECTED, KIND_UNKNOWN, string_view(), c->fd, c->counters.commands);
+        worker.open.erase(c->fd);
+        worker.closed.push_back(c);
+    }
+
+    void reportCommands(GateConnection* c) {
+        commandCount += c->counters.commands - c->reportedCommands;
+        c->reportedCommands = c->counters.commands;
+    }
+
+    void freeConnection(GateConnection* c) {
+        reportCommands(c);
+        close(c->fd); // Also removes it from the epoll set
+        c->session.destroy();
+        delete c;
+    }
+
+    void socketEvent(GateWorker& worker, GateConnection* c, uint32_t events) {
+        if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) c->readable = true;
+        if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) c->writable = true;
+        bool ready = (c->waitingFor == EPOLLIN && c->readable) || (c->waitingFor == EPOLLOUT && c->writable);
+        if (ready) {
+            c->waitingFor = 0;
+            resume(worker, c);
+        }
+    }
+
+    void runPosted(GateWorker& worker) {
+        uint64_t count;
+        ssize_t ignored = read(worker.wakeFd, &count, sizeof(count));
+        (void)ignored;
+        {
+            lock_guard<mutex> lock(worker.postedMutex);
+            worker.resuming.swap(worker.posted);
+        }
+        for (GateConnection* c : worker.resuming) {
+            worker.awaitingJournal--;
+            resume(worker, c);
+        }
+        worker.resuming.clear();
+    }
+
+    void runTimers(GateWorker& worker) {
+        GateWorker::Clock::time_point now = GateWorker::Clock::now();
+        while (!worker.timers.empty() && worker.timers.front().due <= now) {
+            pop_heap(worker.timers.begin(), worker.timers.end(), GateWorker::later);
+            GateConnection* c = worker.timers.back().connection;
+            worker.timers.pop_back();
+            resume(worker, c);
+        }
+    }
+
+    // Reads what the socket has into the input buffer. Returns the number of
+    // new bytes, 0 if there are none yet, -1 at end of input or on error.
+    ssize_t readInput(GateConnection* c) {
+        if (c->inputUsed == c->input.size()) {
+            if (c->input.size() >= SERVER_MAX_LINE) return -1; // No line is this long
+            c->input.resize(c->input.size() * 2);
+        }
+        while (true) {
+            ssize_t n = read(c->fd, c->input.data() + c->inputUsed, c->input.size() - c->inputUsed);
+            if (n > 0) {
+                c->inputUsed += n;
+                return n;
+            }
+            if (n == 0) return -1;
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+            c->readable = false;
+            return 0;
+        }
+    }
+
+    // Sends as much buffered output as the socket takes. False on error.
+    bool sendOutput(GateConnection* c) {
+        while (c->output.size() > 0) {
+            ssize_t n = send(c->fd, c->output.data(), c->output.size(), MSG_NOSIGNAL);
+            if (n > 0) {
+                c->output.consume(n);
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else {
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    c->writable = false;
+                    return true;
+                }
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // The life of one connection: read, run, wait for the journal, answer.
+    GateSession serveConnection(GateWorker& worker, GateConnection* c) {
+        OutputBuffer& out = c->output;
+        CommandCounters& counters = c->counters;
+
+        // A pending exit: quoted, waiting for PAY or CANCEL.
+        string exitPlate;
+        time_t quotedAt = 0;
+        int64_t quotedCents = 0;
+
+        while (true) {
+            if (!c->readable) co_await SocketReady{c, EPOLLIN};
+            ssize_t got = readInput(c);
+            if (got < 0) co_return;
+            if (got == 0) continue;
+            if (c->protocol == PROTOCOL_UNKNOWN) {
+                c->protocol = (uint8_t)c->input[0] == WIRE_MAGIC ? PROTOCOL_BINARY : PROTOCOL_TEXT;
+            }
+
+            uint64_t lsn = 0;       // Highest journal record the answers depend on
+            size_t used = 0;
+            bool desynced = false;
+            while (c->protocol == PROTOCOL_TEXT) {
+                const char* start = c->input.data() + used;
+                const char* newline = (const char*)memchr(start, '\n', c->inputUsed - used);
+                if (newline == nullptr) break;
+                string_view line(start, newline - start);
+                used += line.size() + 1;
+                counters.lines++;
+
+                string_view args = line;
+                string_view verb = nextToken(args);
+                bool valid = true;
+                if (verb == "ENTER") {
+                    VehicleKind kind = parseCommandKind(nextToken(args));
+                    string_view plate = nextToken(args);
+                    valid = kind != KIND_UNKNOWN && !plate.empty() && nextToken(args).empty();
+                    if (valid) {
+                        ParkResult result = lot.park(createVehicle(kind, string(plate), time(0)), false);
+                        co_await JournalCommit{lot, worker, c, result.lsn}; // The barrier opens for a durable park only
+                        out.append(result.status == PARK_OK ? "OPEN " : parkAnswer(result.status));
+                        out.append(plate);
+                        if (result.status == PARK_OK) {
+                            out.append(' ');
+                            out.appendUint(result.spot);
+                            out.append(' ');
+                            out.appendUint(result.lsn);
+                        }
+                        out.append('\n');
+                    }
+                } else if (verb == "EXIT") {
+                    string_view plate = nextToken(args);
+                    valid = !plate.empty() && nextToken(args).empty();
+                    if (valid) {
+                        quotedAt = time(0);
+                        UnparkResult quote = lot.quote(string(plate), quotedAt);
+                        exitPlate = quote.found ? string(plate) : string();
+                        quotedCents = llround(quote.fee * 100);
+                        out.append(quote.found ? "QUOTE " : "ERR NOT_FOUND ");
+                        out.append(plate);
+                        if (quote.found) {
+                            out.append(' ');
+                            out.append(vehicleKindName(quote.kind));
+                            out.append(' ');
+                            out.appendCents(quotedCents);
+                        }
+                        out.append('\n');
+                    }
+                } else if (verb == "PAY") {
+                    int64_t tendered;
+                    valid = !exitPlate.empty() && parseCents(nextToken(args), tendered) && nextToken(args).empty();
+                    if (valid && !co_await PaymentReply{worker, c, paymentLatency, quotedCents, tendered}) {
+                        out.append("DECLINED ");
+                        out.append(exitPlate);
+                        out.append(' ');
+                        out.appendCents(quotedCents);
+                        out.append('\n');
+                    } else if (valid) {
+                        // Charged as quoted: the stay ends at the time of the quote.
+                        UnparkResult result = lot.unpark(exitPlate, quotedAt, false);
+                        co_await JournalCommit{lot, worker, c, result.lsn};
+                        out.append(result.found ? "OPEN " : "ERR NOT_FOUND ");
+                        out.append(exitPlate);
+                        if (result.found) {
+                            out.append(' ');
+                            out.appendUint(result.lsn);
+                            out.append(' ');
+                            out.appendCents(llround(result.fee * 100));
+                        }
+                        out.append('\n');
+                        exitPlate.clear();
+                    }
+                } else if (verb == "CANCEL") {
+                    valid = !exitPlate.empty() && nextToken(args).empty();
+                    if (valid) {
+                        out.append("CANCELLED ");
+                        out.append(exitPlate);
+                        out.append('\n');
+                        exitPlate.clear();
+                    }
+                } else {
+                    CommandOutcome outcome = runCommand(lot, line, out, &lsn);
+                    if (outcome == COMMAND_SKIPPED) continue;
+                    valid = outcome == COMMAND_OK;
+                }
+
+                if (valid) {
+                    counters.commands++;
+                } else {
+                    counters.invalid++;
+                    out.append("ERR SYNTAX ");
+                    out.appendUint(counters.lines);
+                    out.append('\n');
+                }
+            }
+            if (c->protocol == PROTOCOL_BINARY) {
+                used = runWireRequests(lot, c->input.data(), c->inputUsed, out, counters, desynced, &lsn);
+            }
+            reportCommands(c);
+            c->inputUsed -= used;
+            memmove(c->input.data(), c->input.data() + used, c->inputUsed);
+
+            co_await JournalCommit{lot, worker, c, lsn};
+            while (out.size() > 0) {
+                if (!sendOutput(c)) co_return;
+                if (out.size() > 0) co_await SocketReady{c, EPOLLOUT};
+            }
+            if (desynced) co_return; // Lost the request framing: hang up
+        }
+    }
+
+    // Runs sessions until the stop signal, then answers the ones waiting for
+    // a commit and closes every connection.
+    void workerLoop(GateWorker& worker) {
+        worker.epollFd = epoll_create1(EPOLL_CLOEXEC);
+        worker.wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (worker.epollFd < 0 || worker.wakeFd < 0) return;
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.ptr = nullptr;              // Marks the listening socket
+        epoll_ctl(worker.epollFd, EPOLL_CTL_ADD, listenFd, &ev);
+        ev.events = EPOLLIN;                // Stays readable once signalled: stops every worker
+        ev.data.ptr = this;
+        epoll_ctl(worker.epollFd, EPOLL_CTL_ADD, serverStopFd, &ev);
+        ev.events = EPOLLIN;
+        ev.data.ptr = &worker;
+        epoll_ctl(worker.epollFd, EPOLL_CTL_ADD, worker.wakeFd, &ev);
+
+        epoll_event events[64];
+        bool running = true;
+        while (running || worker.awaitingJournal > 0) {
+            int n = epoll_wait(worker.epollFd, events, 64, running ? worker.timeoutMillis() : -1);
+            if (n < 0 && errno != EINTR) break;
+            for (int i = 0; i < n; i++) {
+                void* source = events[i].data.ptr;
+                if (source == this) {
+                    running = false;
+                    epoll_ctl(worker.epollFd, EPOLL_CTL_DEL, serverStopFd, nullptr);
+                    epoll_ctl(worker.epollFd, EPOLL_CTL_DEL, listenFd, nullptr);
+                } else if (source == nullptr) {
+                    if (running) acceptConnections(worker);
+                } else if (source == &worker) {
+                    runPosted(worker);
+                } else {
+                    socketEvent(worker, (GateConnection*)source, events[i].events);
+                }
+            }
+            if (running) runTimers(worker);
+            for (GateConnection* c : worker.closed) freeConnection(c);
+            worker.closed.clear();
+        }
+        for (auto& entry : worker.open) {
+            sendOutput(entry.second);
+            freeConnection(entry.second);
+        }
+    }
+
+public:
+    GateServer(ParkingLot& lot, const string& path, chrono::microseconds paymentLatency)
+        : lot(lot), path(path), listenFd(-1), paymentLatency(paymentLatency), connectionCount(0), commandCount(0) {}
+
+    ~GateServer() {
+        if (listenFd >= 0) {
+            close(listenFd);
+            unlink(path.c_str());
+        }
+    }
+
+    // Binds the socket. A stale socket file is replaced, a live one is not.
+    bool listen() {
+        sockaddr_un address;
+        if (!unixSocketAddress(path, address)) return false;
+
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool inUse = probe >= 0 && connect(probe, (sockaddr*)&address, sizeof(address)) == 0;
+        if (probe >= 0) close(probe);
+        if (inUse) return false;
+        unlink(path.c_str());
+
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) return false;
+        if (::bind(fd, (sockaddr*)&address, sizeof(address)) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+            close(fd);
+            return false;
+        }
+        listenFd = fd;
+        return true;
+    }
+
+    // Serves until SIGINT/SIGTERM, then closes all connections.
+    void run(int threads) {
+        vector<GateWorker> workers(threads);
+        vector<thread> loops;
+        for (int i = 0; i < threads; i++) loops.push_back(thread(&GateServer::workerLoop, this, ref(workers[i])));
+        for (thread& loop : loops) loop.join();
+    }
+
+    uint64_t connections() const { return connectionCount; }
+    uint64_t commands() const { return commandCount; }
+};
+
+int runServer(ParkingLot& lot, const string& path, int threads, int paymentLatencyMillis) {
+    serverStopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    GateServer server(lot, path, chrono::milliseconds(paymentLatencyMillis));
+    if (serverStopFd < 0 || !server.listen()) {
+        cout << "Error: Could not listen on " << path << "." << endl;
+        return 1;
+    }
+    raiseOpenFileLimit();
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onServerSignal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    cout << "Gate server listening on " << path << " (" << threads << " threads). Ctrl+C to stop." << endl;
+    server.run(threads);
+    gateLog.flush();
+    cout << "Gate server stopped: " << server.connections() << " connections, "
+         << server.commands() << " commands." << endl;
+    close(serverStopFd);
+    return 0;
+}
+
+// LOAD GENERATOR
+// Opens 'clients' connections to a gate server and keeps 'pipeline' requests
+// in flight on each: alternating park and unpark of the connection's own
+// plates, so the lot never fills up (capacity >= clients * pipeline / 2).
+// Answers come back in order, so each one completes the oldest request of
+// its connection. With 'binary' the wire protocol is used instead of text,
+// with 'sessions' every plate goes through an ENTER / EXIT / PAY conversation.
+// Reports requests per second and latency percentiles.
+struct LoadConnection {
+    int fd;
+    uint64_t sent;
+    uint64_t answered;
+    uint64_t received;          // Response bytes (binary protocol)
+    vector<int64_t> sentAt;     // Send time (ns) of request i at i % pipeline
+    string pending;             // Requests not written yet
+    bool atLineStart;
+};
+
+int runLoadTest(const string& path, int clients, int pipeline, int seconds, bool binary, bool sessions) {
+    typedef chrono::steady_clock Clock;
+    auto nowNanos = [] { return chrono::duration_cast<chrono::nanoseconds>(Clock::now().time_since_epoch()).count(); };
+
+    raiseOpenFileLimit();
+    sockaddr_un address;
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (!unixSocketAddress(path, address) || epollFd < 0) {
+        cout << "Error: Could not connect to " << path << "." << endl;
+        return 1;
+    }
+    vector<LoadConnection> connections(clients);
+    for (int i = 0; i < clients; i++) {
+        LoadConnection& c = connections[i];
+        c.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (c.fd < 0 || connect(c.fd, (sockaddr*)&address, sizeof(address)) != 0) {
+            cout << "Error: Could not connect to " << path << "." << endl;
+            return 1;
+        }
+        fcntl(c.fd, F_SETFL, O_NONBLOCK);
+        c.sent = c.answered = c.received = 0;
+        c.sentAt.assign(pipeline, 0);
+        c.atLineStart = true;
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, c.fd, &ev);
+    }
+
+    // Request n of connection i: even n parks plate G<i>N<n/2>, odd n unparks it.
+    // Sessions: ENTER, EXIT and PAY (more than any fee) for plate G<i>N<n/3>.
+    auto queueRequest = [&](int i) {
+        LoadConnection& c = connections[i];
+        uint64_t steps = (sessions && !binary) ? 3 : 2;
+        string plate = "G" + to_string(i) + "N" + to_string(c.sent / steps % 1000000);
+        if (steps == 3) {
+            const char* step[] = {"ENTER CAR ", "EXIT ", "PAY 1000"};
+            c.pending += step[c.sent % 3];
+            if (c.sent % 3 != 2) c.pending += plate;
+            c.pending += '\n';
+        } else if (binary) {
+            WireRequest request;
+            memset(&request, 0, sizeof(request));
+            request.magic = WIRE_MAGIC;
+            request.op = (c.sent % 2 == 0) ? WIRE_PARK : WIRE_UNPARK;
+            request.kind = KIND_CAR;
+            request.requestId = (uint32_t)c.sent;
+            packPlate(plate, request.plate);
+            c.pending.append((const char*)&request, sizeof(request));
+        } else {
+            c.pending += (c.sent % 2 == 0) ? "P CAR " : "U ";
+            c.pending += plate;
+            c.pending += '\n';
+        }
+        c.sentAt[c.sent % pipeline] = nowNanos();
+        c.sent++;
+    };
+    auto flushRequests = [&](LoadConnection& c) {
+        while (!c.pending.empty()) {
+            ssize_t n = send(c.fd, c.pending.data(), c.pending.size(), MSG_NOSIGNAL);
+            if (n <= 0) return n < 0 && (errno == EAGAIN || errno == EINTR);
+            c.pending.erase(0, n);
+        }
+        return true;
+    };
+
+    vector<uint64_t> latencyNanos;
+    latencyNanos.reserve(1 << 20);
+    uint64_t errors = 0;
+    bool failed = false;
+
+    int64_t start = nowNanos();
+    int64_t deadline = start + (int64_t)seconds * 1000000000;
+    for (int i = 0; i < clients; i++) {
+        for (int k = 0; k < pipeline; k++) queueRequest(i);
+        failed |= !flushRequests(connections[i]);
+    }
+
+    // Runs until the deadline, then waits (up to 5 s) for the requests in flight.
+    epoll_event events[64];
+    char buffer[65536];
+    uint64_t inFlight = (uint64_t)clients * pipeline;
+    while (!failed && inFlight > 0 && nowNanos() < deadline + 5000000000LL) {
+        int n = epoll_wait(epollFd, events, 64, 100);
+        for (int e = 0; e < n; e++) {
+            int i = events[e].data.u32;
+            LoadConnection& c = connections[i];
+            ssize_t got = read(c.fd, buffer, sizeof(buffer));
+            if (got <= 0) {
+                if (got < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+                failed = true;
+                break;
+            }
+            int64_t now = nowNanos();
+            for (ssize_t b = 0; b < got; b++) {
+                if (binary) {
+                    size_t position = c.received++ % sizeof(WireResponse);
+                    if (position == offsetof(WireResponse, status) && buffer[b] != WIRE_OK) errors++;
+                    if (position != sizeof(WireResponse) - 1) continue;
+                } else {
+                    if (c.atLineStart && (buffer[b] == 'E' || buffer[b] == 'D')) errors++; // ERR, DECLINED
+                    c.atLineStart = (buffer[b] == '\n');
+                    if (!c.atLineStart) continue;
+                }
+                latencyNanos.push_back(now - c.sentAt[c.answered % pipeline]);
+                c.answered++;
+                if (now < deadline) queueRequest(i);
+                else inFlight--;
+            }
+            failed |= !flushRequests(c);
+        }
+    }
+    double elapsed = (nowNanos() - start) / 1e9;
+    for (LoadConnection& c : connections) close(c.fd);
+    close(epollFd);
+    if (failed) {
+        cout << "Error: Lost the connection to " << path << "." << endl;
+        return 1;
+    }
+
+    cout << fixed << setprecision(1);
+    cout << "=== LOAD TEST (" << (binary ? "binary, " : sessions ? "sessions, " : "text, ") << clients << " connections x " << pipeline << " in flight, " << seconds << " s) ===" << endl;
+    cout << "Requests: " << latencyNanos.size() << " (" << errors << " errors), "
+         << setprecision(0) << latencyNanos.size() / elapsed << " req/s" << defaultfloat << endl;
+    printLatencyPercentiles(latencyNanos);
+    return 0;
+}
+
+// Matches "--name=value" command line arguments.
+bool optionValue(const string& arg, const string& name, string& value) {
+    string prefix = "--" + name + "=";
+    if (arg.compare(0, prefix.size(), prefix) != 0) return false;
+    value = arg.substr(prefix.size());
+    return true;
+}
+
+// A whole token as an integer in [minimum, maximum] ("2k", " 5" or "1e3" are
+// rejected rather than read as a different number).
+template <typename Int>
+bool parseIntOption(string_view text, Int minimum, Int maximum, Int& value) {
+    Int parsed;
+    from_chars_result result = from_chars(text.data(), text.data() + text.size(), parsed);
+    if (text.empty() || result.ec != errc() || result.ptr != text.data() + text.size()) return false;
+    if (parsed < minimum || parsed > maximum) return false;
+    value = parsed;
+    return true;
+}
+
+// A whole token as a finite number above zero, or at least zero if
+// 'zeroAllowed' (e.g. no warm-up at all).
+bool parseNumberOption(string_view text, bool zeroAllowed, double& value) {
+    double parsed;
+    if (!parseFiniteNumber(text, parsed) || parsed < 0 || (parsed == 0 && !zeroAllowed)) return false;
+    value = parsed;
+    return true;
+}
+
+void printUsage(const char* program) {
+    cout << "Usage: " << program << " [options]" << endl;
+    cout << "  --durability=none|batched|strict  Journal fsync policy (default: batched)" << endl;
+    cout << "  --commit-window-us=N              Max wait before a batch is written (default: 2000)" << endl;
+    cout << "  --io-backend=blocking|uring       Journal commits and checkpoints via write/fsync or io_uring (default: blocking)" << endl;
+    cout << "  --commit-batch=N                  Write a batch early at N records (default: 256)" << endl;
+    cout << "  --checkpoint-events=N             Background checkpoint after N events (default: 1000)" << endl;
+    cout << "  --checkpoint-seconds=N            Background checkpoint after N seconds with changes (default: 60)" << endl;
+    cout << "  --lazy-load                       Serve parked vehicles from the mapped snapshot, load on first use" << endl;
+    cout << "  --import-text=FILE                Add vehicles from a TYPE PLATE TIMESTAMP file, then exit" << endl;
+    cout << "  --export-text=FILE                Write parked vehicles as TYPE PLATE TIMESTAMP, then exit" << endl;
+    cout << "  --export-csv=FILE, --export-json=FILE" << endl;
+    cout << "                                    Stream parked vehicles as CSV / JSON, then exit" << endl;
+    cout << "  --export-history-csv=FILE, --export-history-json=FILE" << endl;
+    cout << "                                    Stream completed sessions as CSV / JSON, then exit" << endl;
+    cout << "  --export-arrow=FILE, --export-history-arrow=FILE" << endl;
+    cout << "                                    Write parked vehicles / completed sessions as an Arrow IPC file" << endl;
+    cout << "  --capacity=N                      Number of parking spots (default: 7)" << endl;
+    cout << "  --batch[=FILE]                    Run P/U/S commands from FILE or stdin without the menu" << endl;
+    cout << "  --serve[=SOCKET]                  Accept gate connections on a Unix socket (default: " << GATE_SOCKET_FILE << ")" << endl;
+    cout << "  --server-threads=N                Event loop threads of the gate server (default: 2)" << endl;
+    cout << "  --payment-latency-ms=N            Reply time of the simulated payment processor (default: 20)" << endl;
+    cout << "  --load-test[=SOCKET]              Drive a running gate server and report req/s and latency" << endl;
+    cout << "  --clients=N, --pipeline=N, --duration=SECONDS" << endl;
+    cout << "                                    Load test connections, requests in flight each, run time (16, 8, 10)" << endl;
+    cout << "  --binary                          Load test with the binary wire protocol instead of text" << endl;
+    cout << "  --sessions                        Load test with ENTER / EXIT / PAY gate conversations" << endl;
+    cout << "  --replay=TRACE                    Replay a timestamped command trace on an empty in-memory lot" << endl;
+    cout << "  --simulate[=DAYS]                 Discrete-event simulation of DAYS of traffic (default: 365, 5000 spots)" << endl;
+    cout << "  --generate-trace=FILE             Write synthetic traffic as a trace for --replay, then exit" << endl;
+    cout << "  --days=N                          Days of simulated / generated traffic (default: 365)" << endl;
+    cout << "  --arrival-rate=N, --mean-stay=HOURS, --seed=N" << endl;
+    cout << "                                    Simulated arrivals per hour (default: 80% load), mean stay (3), random seed (1)" << endl;
+    cout << "  --profile=flat|diurnal            Constant arrival rate, or daily and weekly peaks (default: flat)" << endl;
+    cout << "  --dwell=exponential|lognormal|FILE" << endl;
+    cout << "                                    Stay distribution, or resample the stays of a history archive (default: exponential)" << endl;
+    cout << "  --dwell-sigma=X                   Spread of lognormal stays (default: 0.8)" << endl;
+    cout << "  --mix=CAR,TRUCK,MOTORBIKE         Shares of the vehicle types (default: 75,10,15)" << endl;
+    cout << "  --monte-carlo[=RUNS]              Simulate RUNS independent days on all cores, report 95% intervals (default: 1000)" << endl;
+    cout << "  --plan-capacity[=PERCENT]         Find the fewest spots that turn away under PERCENT of arrivals (default: 1)" << endl;
+    cout << "  --sweep=FILE                      Simulate a week per grid point, stream one CSV row each to FILE" << endl;
+    cout << "  --sweep-capacity=LIST, --sweep-rate=LIST, --sweep-minimum=LIST" << endl;
+    cout << "                                    Grid of spots, car $/hour, minimum billed hours (a,b,c or from:to:step)" << endl;
+    cout << "  --price-elasticity=E              Sweep demand scales with (rate / $20)^-E (default: 0)" << endl;
+    cout << "  --warmup-hours=H, --threads=N     Uncounted lead-in of each run (12), worker threads (all cores)" << endl;
+    cout << "  --bench-text-load=LINES           Benchmark the text loader on a synthetic file" << endl;
+    cout << "  --self-check                      Crash-test recovery and the gate protocols in a scratch directory" << endl;
+    cout << "  --history-report[=FILE]           Summarize completed sessions (default: " << HISTORY_FILE << ")" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    StorageOptions storageOptions;
+    JournalOptions& journalOptions = storageOptions.journal;
+    string importFile, exportFile, batchFile, replayFile;
+    bool batchMode = false;
+    int capacity = 7;
+    string serverSocket, loadTestSocket;
+    int serverThreads = 2, paymentLatencyMillis = 20, loadClients = 16, loadPipeline = 8, loadSeconds = 10;
+    bool loadBinary = false, loadSessions = false;
+    bool simulate = false;
+    SimulationConfig simulation;    // Its capacity follows --capacity, default 5000
+    WorkloadConfig& workload = simulation.workload;
+    string traceOutput, dwellHistory;
+    bool monteCarlo = false, daysSet = false;
+    MonteCarloConfig monteCarloOptions;
+    SweepConfig sweep;
+
+    // Streaming exports requested on the command line.
+    struct ExportJob {
+        bool history;
+        ExportFormat format;
+        string path;
+    };
+    vector<ExportJob> exportJobs;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i], value;
+        bool valid = true; // Numeric options clear it for a malformed value
+        if (optionValue(arg, "durability", value)) {
+            if (value == "none") journalOptions.durability = DURABILITY_NONE;
+            else if (value == "batched") journalOptions.durability = DURABILITY_BATCHED;
+            else if (value == "strict") journalOptions.durability = DURABILITY_STRICT;
+            else { printUsage(argv[0]); return 1; }
+        } else if (optionValue(arg, "io-backend", value)) {
+            if (value == "blocking") journalOptions.ioBackend = IO_BLOCKING;
+            else if (value == "uring") journalOptions.ioBackend = IO_URING;
+            else { printUsage(argv[0]); return 1; }
+        } else if (optionValue(arg, "commit-window-us", value)) {
+            valid = parseIntOption(value, 0, INT_MAX, journalOptions.commitWindowMicros);
+        } else if (optionValue(arg, "commit-batch", value)) {
+            valid = parseIntOption(value, 1, INT_MAX, journalOptions.commitBatchRecords);
+        } else if (optionValue(arg, "checkpoint-events", value)) {
+            valid = parseIntOption(value, 1, INT_MAX, storageOptions.checkpointIntervalEvents);
+        } else if (optionValue(arg, "checkpoint-seconds", value)) {
+            valid = parseIntOption(value, 1, INT_MAX, storageOptions.checkpointIntervalSeconds);
+        } else if (arg == "--lazy-load") {
+            storageOptions.lazyLoad = true;
+        } else if (optionValue(arg, "import-text", value)) {
+            importFile = value;
+        } else if (optionValue(arg, "export-text", value)) {
+            exportFile = value;
+        } else if (optionValue(arg, "export-csv", value)) {
+            exportJobs.push_back({false, EXPORT_CSV, value});
+        } else if (optionValue(arg, "export-json", value)) {
+            exportJobs.push_back({false, EXPORT_JSON, value});
+        } else if (optionValue(arg, "export-history-csv", value)) {
+            exportJobs.push_back({true, EXPORT_CSV, value});
+        } else if (optionValue(arg, "export-history-json", value)) {
+            exportJobs.push_back({true, EXPORT_JSON, value});
+        } else if (optionValue(arg, "export-arrow", value)) {
+            exportJobs.push_back({false, EXPORT_ARROW, value});
+        } else if (optionValue(arg, "export-history-arrow", value)) {
+            exportJobs.push_back({true, EXPORT_ARROW, value});
+        } else if (optionValue(arg, "capacity", value)) {
+            valid = parseIntOption(value, 1, INT_MAX, capacity);
+            simulation.capacity = capacity;
+        } else if (arg == "--simulate") {
+            simulate = true;
+        } else if (optionValue(arg, "simulate", value)) {
+            simulate = daysSet = true;
+            valid = parseNumberOption(value, false, workload.days);
+        } else if (optionValue(arg, "days", value)) {
+            daysSet = true;
+            valid = parseNumberOption(value, false, workload.days);
+        } else if (arg == "--monte-carlo") {
+            monteCarlo = true;
+        } else if (optionValue(arg, "monte-carlo", value)) {
+            monteCarlo = true;
+            valid = parseIntOption(value, 1, INT_MAX, monteCarloOptions.runs);
+        } else if (arg == "--plan-capacity") {
+            monteCarlo = monteCarloOptions.planCapacity = true;
+        } else if (optionValue(arg, "plan-capacity", value)) {
+            monteCarlo = monteCarloOptions.planCapacity = true;
+            valid = parseNumberOption(value, false, monteCarloOptions.targetTurnedAway)
+                && monteCarloOptions.targetTurnedAway < 100;
+        } else if (optionValue(arg, "sweep", value)) {
+            sweep.path = value;
+        } else if (optionValue(arg, "sweep-capacity", value)) {
+            if (!parseGrid(value, sweep.capacities) || *min_element(sweep.capacities.begin(), sweep.capacities.end()) < 1
+                || *max_element(sweep.capacities.begin(), sweep.capacities.end()) > INT_MAX) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (optionValue(arg, "sweep-rate", value)) {
+            if (!parseGrid(value, sweep.carRates) || *min_element(sweep.carRates.begin(), sweep.carRates.end()) < 0) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (optionValue(arg, "sweep-minimum", value)) {
+            if (!parseGrid(value, sweep.minimumHours) || *min_element(sweep.minimumHours.begin(), sweep.minimumHours.end()) < 0) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (optionValue(arg, "price-elasticity", value)) {
+            valid = parseNumberOption(value, true, sweep.priceElasticity);
+        } else if (optionValue(arg, "warmup-hours", value)) {
+            valid = parseNumberOption(value, true, monteCarloOptions.warmupHours);
+        } else if (optionValue(arg, "threads", value)) {
+            valid = parseIntOption<unsigned>(value, 1, 1024, monteCarloOptions.threads);
+        } else if (optionValue(arg, "generate-trace", value)) {
+            traceOutput = value;
+        } else if (optionValue(arg, "arrival-rate", value)) {
+            valid = parseNumberOption(value, false, workload.arrivalsPerHour);
+        } else if (optionValue(arg, "profile", value)) {
+            if (value == "flat") workload.profile = PROFILE_FLAT;
+            else if (value == "diurnal") workload.profile = PROFILE_DIURNAL;
+            else { printUsage(argv[0]); return 1; }
+        } else if (optionValue(arg, "mean-stay", value)) {
+            valid = parseNumberOption(value, false, workload.meanStayHours);
+        } else if (optionValue(arg, "dwell", value)) {
+            if (value == "exponential") workload.dwell = DWELL_EXPONENTIAL;
+            else if (value == "lognormal") workload.dwell = DWELL_LOGNORMAL;
+            else dwellHistory = value;  // A history archive to resample
+        } else if (optionValue(arg, "dwell-sigma", value)) {
+            valid = parseNumberOption(value, false, workload.dwellSigma);
+        } else if (optionValue(arg, "mix", value)) {
+            vector<double> shares;
+            if (!parseGrid(value, shares) || shares.size() != 3 || value.find(':') != string::npos
+                || *min_element(shares.begin(), shares.end()) < 0 || shares[0] + shares[1] + shares[2] <= 0) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            double total = shares[KIND_CAR] + shares[KIND_TRUCK] + shares[KIND_MOTORBIKE];
+            workload.truckShare = shares[KIND_TRUCK] / total;
+            workload.motorbikeShare = shares[KIND_MOTORBIKE] / total;
+        } else if (optionValue(arg, "seed", value)) {
+            valid = parseIntOption<uint64_t>(value, 0, UINT64_MAX, workload.seed);
+        } else if (arg == "--batch") {
+            batchMode = true;
+        } else if (optionValue(arg, "batch", value)) {
+            batchMode = true;
+            batchFile = value;
+        } else if (arg == "--serve") {
+            serverSocket = GATE_SOCKET_FILE;
+        } else if (optionValue(arg, "serve", value)) {
+            serverSocket = value;
+        } else if (optionValue(arg, "server-threads", value)) {
+            valid = parseIntOption(value, 1, INT_MAX, serverThreads);
+        } else if (optionValue(arg, "payment-latency-ms", value)) {
+            valid = parseIntOption(value, 0, INT_MAX, paymentLatencyMillis);
+        } else if (arg == "--load-test") {
+            loadTestSocket = GATE_SOCKET_FILE;
+        } else if (optionValue(arg, "load-test", value)) {
+            loadTestSocket = value;
+        } else if (arg == "--binary") {
+            loadBinary = true;
+        } else if (arg == "--sessions") {
+            loadSessions = true;
+        } else if (optionValue(arg, "clients", value)) {
+            valid = parseIntOption(value, 1, INT_MAX, loadClients);
+        } else if (optionValue(arg, "pipeline", value)) {
+            valid = parseIntOption(value, 1, INT_MAX, loadPipeline);
+        } else if (optionValue(arg, "duration", value)) {
+            valid = parseIntOption(value, 1, INT_MAX, loadSeconds);
+        } else if (optionValue(arg, "replay", value)) {
+            replayFile = value;
+        } else if (arg == "--self-check") {
+            return runSelfCheck();
+        } else if (optionValue(arg, "bench-text-load", value)) {
+            size_t lines;
+            if (!parseIntOption<size_t>(value, 1, SIZE_MAX, lines)) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            return runTextLoadBenchmark(lines);
+        } else if (arg == "--history-report") {
+            return runHistoryReport(HISTORY_FILE);
+        } else if (optionValue(arg, "history-report", value)) {
+            return runHistoryReport(value);
+        } else {
+            valid = false;
+        }
+        if (!valid) {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    // The replay builds its own in-memory lot (after --capacity is known).
+    if (!replayFile.empty()) return runReplay(replayFile, capacity);
+    if (!dwellHistory.empty()) {
+        if (!loadObservedStays(dwellHistory, workload.observedStays)) {
+            cout << "Error: No recorded stays in " << dwellHistory << "." << endl;
+            return 1;
+        }
+        double total = 0;
+        for (double stay : workload.observedStays) total += stay;
+        workload.dwell = DWELL_EMPIRICAL;
+        workload.meanStayHours = max(0.01, total / workload.observedStays.size() / 3600);
+    }
+    if (!traceOutput.empty()) return runTraceGeneration(workload, simulation.capacity, traceOutput);
+    if (!sweep.path.empty()) {
+        if (sweep.capacities.empty()) sweep.capacities.push_back(simulation.capacity);
+        if (sweep.carRates.empty()) sweep.carRates.push_back(STANDARD_TARIFF.hourlyRate[KIND_CAR]);
+        if (sweep.minimumHours.empty()) sweep.minimumHours.push_back(STANDARD_TARIFF.minimumHours);
+        if (!daysSet) workload.days = 7; // One week per point
+        return runSweep(simulation, sweep, monteCarloOptions);
+    }
+    if (monteCarlo) {
+        if (!daysSet) workload.days = 1; // Many independent days rather than one long run
+        return runMonteCarloPlanning(simulation, monteCarloOptions);
+    }
+    if (simulate) return runSimulation(simulation);
+    // The load generator is a client only.
+    if (!loadTestSocket.empty()) {
+        return runLoadTest(loadTestSocket, loadClients, loadPipeline, loadSeconds, loadBinary, loadSessions);
+    }
+
+    ParkingLot myParkingLot(capacity, storageOptions);
+    if (!myParkingLot.dataFits()) return 1;
+
+    // Import, batch commands, the gate server and exports run without the interactive menu.
+    if (!importFile.empty() || batchMode || !serverSocket.empty() || !exportFile.empty() || !exportJobs.empty()) {
+        if (!importFile.empty()) {
+            int added = myParkingLot.importText(importFile);
+            if (added < 0) {
+                cout << "Error: Could not import " << importFile << "." << endl;
+                return 1;
+            }
+            cout << "Imported " << added << " vehicles from " << importFile << "." << endl;
+        }
+        if (batchMode && runBatch(myParkingLot, batchFile) != 0) return 1;
+        if (!serverSocket.empty() && runServer(myParkingLot, serverSocket, serverThreads, paymentLatencyMillis) != 0) return 1;
+        if (!exportFile.empty()) {
+            if (!myParkingLot.exportText(exportFile)) {
+                cout << "Error: Could not export to " << exportFile << "." << endl;
+                return 1;
+            }
+            cout << "Exported vehicles to " << exportFile << "." << endl;
+        }
+        for (const ExportJob& job : exportJobs) {
+            int64_t rows;
+            if (job.format == EXPORT_ARROW) {
+                rows = job.history ? myParkingLot.exportHistoryArrow(job.path) : myParkingLot.exportLiveArrow(job.path);
+            } else {
+                rows = job.history ? myParkingLot.exportHistory(job.path, job.format)
+                                   : myParkingLot.exportLive(job.path, job.format);
+            }
+            if (rows < 0) {
+                cout << "Error: Could not export to " << job.path << "." << endl;
+                return 1;
+            }
+            cout << "Exported " << rows << (job.history ? " sessions" : " vehicles") << " to " << job.path << "." << endl;
+        }
+        return 0;
+    }
     int choice;
     string plate;
 
@@ -261,6 +7241,7 @@ int main() {
     cout << "===========================================" << endl;
 
     while (true) {
+        gateLog.flush(); // Receipts and messages of the last choice come first
         cout << "1. Park Car" << endl;
         cout << "2. Park Truck" << endl;
         cout << "3. Park Motorbike" << endl;